@@ -0,0 +1,9 @@
+/// @file
+/// @ingroup     minexamples
+/// @copyright    Copyright 2018 The Min-DevKit Authors. All rights reserved.
+/// @license    Use of this source code is governed by the MIT License found in the License.md file.
+
+// Multichannel variant of bfa.stacked_tables~: one oscillator per channel of a single mc outlet,
+// all reading the same frame stack.
+#define BFA_STACKED_TABLES_MC 1
+#include "../bfa.stacked_tables_tilde/bfa.stacked_tables_tilde.cpp"
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include "thread_pool.h"
+
+namespace Butterfly {
+
+/// Runs factory jobs on the shared thread pool and hands the results back to the main thread
+/// in submission order, so frames added in bulk keep their order. See AsyncFrameBuilder.
+template<class Result>
+class AsyncBuilder
+{
+public:
+	/// @param resultReady  called from a worker thread whenever a job has finished, must be thread-safe (e.g. min's queue<>::set)
+	explicit AsyncBuilder(std::function<void()> resultReady) : resultReady(std::move(resultReady)) {}
+
+	// Blocks until running jobs are done, they must not call resultReady on a destroyed owner
+	~AsyncBuilder() {
+		std::unique_lock lock{ mutex };
+		idle.wait(lock, [this] { return running == 0; });
+	}
+
+	AsyncBuilder(const AsyncBuilder&) = delete;
+	AsyncBuilder& operator=(const AsyncBuilder&) = delete;
+
+	void submit(std::function<Result()> factory) {
+		auto job = std::make_shared<Job>();
+		{
+			std::scoped_lock lock{ mutex };
+			jobs.push_back(job);
+			++running;
+		}
+		sharedThreadPool().submit([this, job, factory = std::move(factory)] {
+			std::optional<Result> result;
+			std::string error;
+			try {
+				result = factory();
+			} catch (const std::exception& e) {
+				error = e.what();
+			} catch (...) {
+				error = "unknown error";
+			}
+			{
+				std::scoped_lock lock{ mutex };
+				job->result = std::move(result);
+				job->error = std::move(error);
+				job->done = true;
+			}
+			resultReady();
+			std::scoped_lock lock{ mutex };
+			--running;
+			idle.notify_all();
+		});
+	}
+
+	/// Number of submitted jobs that have not been collected yet.
+	size_t numPending() const {
+		std::scoped_lock lock{ mutex };
+		return jobs.size();
+	}
+
+	/// @brief Main thread: passes finished results to commit(Result&&) in submission order, and the reason of each
+	/// failed job to failed(const std::string&). Stops at the first job that is still running.
+	/// @return number of committed results
+	template<class Fn, class FailFn>
+	size_t collect(Fn&& commit, FailFn&& failed) {
+		size_t numCommitted{};
+		while (true) {
+			std::shared_ptr<Job> job;
+			{
+				std::scoped_lock lock{ mutex };
+				if (jobs.empty() || !jobs.front()->done) { break; }
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			if (job->result) {
+				commit(std::move(*job->result));
+				++numCommitted;
+			} else {
+				failed(job->error);
+			}
+		}
+		return numCommitted;
+	}
+
+private:
+	struct Job
+	{
+		std::optional<Result> result;
+		std::string error;		// why there is no result
+		bool done{ false };
+	};
+
+	std::function<void()> resultReady;
+	mutable std::mutex mutex;
+	std::condition_variable idle;
+	std::deque<std::shared_ptr<Job>> jobs;
+	size_t running{};
+};
+
+}
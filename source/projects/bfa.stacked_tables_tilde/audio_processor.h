@@ -1,21 +1,55 @@
 #pragma once
 
-#include "morphing_wavetable_oscillator.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "ramped_value.h"
 #include "release_pool.h"
+#include "block_oscillator.h"
+#include "state_handoff.h"
+#include "parameter_store.h"
+#include "halfband_decimator.h"
 
 namespace Butterfly {
 
 enum class ParameterType {
 	gain,
 	frequency,
+	morphGlide,			// before morphPos, immediate values are applied in this order
 	morphPos,
-	sampleRate
+	sampleRate,
+	numVoices,
+	unisonVoices,
+	unisonDetune,
+	unisonWidth,
+	oversampling,
+	note,				// never coalesced, see addParamEvent()
+	numStoredParameters = note
+};
+
+/// Signal inlets, nullptr if not connected. Each one holds a sample per output sample.
+struct SignalInputs
+{
+	const c74::min::sample* morph{};
+	const c74::min::sample* frequency{};
+	const c74::min::sample* sync{};		// hard sync, without voices and unison only
+
+	SignalInputs advancedBy(int offset) const {
+		auto advance = [offset](const c74::min::sample* signal) { return signal ? signal + offset : nullptr; };
+		return { advance(morph), advance(frequency), advance(sync) };
+	}
 };
 
 struct Event
 {
+	static constexpr int64_t immediate = -1;
+
 	ParameterType parameterType{};
-	double value{};
+	double value{};		// note: the note number
+	int64_t time{ immediate };	// sample time to apply the event at (see AudioProcessor::getSampleTime()), immediate: start of the next block
+	float velocity{};	// note only, 0 is a note off
+	float morph{ VoiceBank::sharedMorph };	// note only, the voice's own morph position, see VoiceBank::noteOn()
 };
 
 
@@ -24,18 +58,50 @@ constexpr auto make_span(It begin, It end) {
 	return std::span<std::remove_pointer_t<typename std::iterator_traits<It>::pointer>>(&(*begin), std::distance(begin, end));
 }
 
-class AudioProcessor
+/// @brief Immutable snapshot of all frames, built on the UI thread.
+/// Carries the arrays the oscillator reads, so the audio thread neither allocates nor touches reference counts,
+/// whatever the number of frames.
+struct FramesState
+{
+	void add(std::shared_ptr<const FrameTables> multitable, float gain) {
+		waveforms.push_back(multitable.get());
+		gains.push_back(gain);
+		multitables.push_back(std::move(multitable));
+	}
+
+	std::vector<std::shared_ptr<const FrameTables>> multitables;	// shared with the frames and other states
+	std::vector<const FrameTables*> waveforms;						// same tables, read by the oscillator
+	std::vector<float> gains;										// gain and polarity, applied at render time
+};
+
+/// @brief Per-channel offsets of the multichannel variant, built on the UI thread.
+struct ChannelLayout
 {
-	using Multitable = std::vector<Wavetable<float>>;
-	using MultitableCollection = std::vector<Multitable>;
-	using State = MultitableCollection;
+	/// @param frequencyOffsets  cents per channel, the last one repeats for further channels
+	/// @param morphOffsets      added to the morph position per channel, the last one repeats for further channels
+	ChannelLayout(int numChannels, const std::vector<float>& frequencyOffsets, const std::vector<float>& morphOffsets) : numChannels(numChannels) {
+		for (int c = 0; c < numChannels; ++c) {
+			const float cents = frequencyOffsets.empty() ? 0.f : frequencyOffsets[std::min<size_t>(c, frequencyOffsets.size() - 1)];
+			frequencyRatios.push_back(std::exp2(cents / 1200.f));
+			this->morphOffsets.push_back(morphOffsets.empty() ? 0.f : morphOffsets[std::min<size_t>(c, morphOffsets.size() - 1)]);
+		}
+	}
+
+	int numChannels{};
+	std::vector<float> frequencyRatios;
+	std::vector<float> morphOffsets;
+};
 
+class AudioProcessor
+{
 public:
-	void init(double oscFreq, double sampleRate, int maxFrames, double gain = 1.) {
+	using State = FramesState;
+	static constexpr int maxChannels = 64;
+	static constexpr int maxOversampling = 4;
+
+	void init(double oscFreq, double sampleRate, double gain = 1.) {
 		setSampleRate(sampleRate);
-		frequency.set(oscFreq);
-		osc.setMaxNumWaveforms(maxFrames);
-		waveforms.reserve(maxFrames);
+		setFrequency(oscFreq);
 		this->gain.set(gain);
 	}
 
@@ -44,14 +110,42 @@ public:
 	//=====================================
 	// UI thread only!
 	void changeState(State&& newState) {
-		auto newSharedState = std::make_shared<State>(newState);
+		auto newSharedState = std::make_shared<State>(std::move(newState));
 		releasePool.add(newSharedState);
-		std::atomic_store(&currentState, newSharedState);
+		stateHandoff.publish(std::move(newSharedState));
 		releasePool.clearUnused();
 	}
-	// UI thread only!
+	// UI thread only! Immediate events coalesce, the audio thread only applies the latest value per parameter.
+	// Notes are queued, even immediate ones.
 	void addParamEvent(Event event) {
-		eventQueue.enqueue(event);
+		if (event.time == Event::immediate && event.parameterType != ParameterType::note) {
+			parameters.set(static_cast<size_t>(event.parameterType), event.value);
+		} else {
+			eventQueue.enqueue(event);
+		}
+	}
+
+	/// @brief Allocates the oscillators of processChannels(). UI thread, before the audio thread calls processChannels().
+	void enableChannels() {
+		channelOscs.resize(maxChannels);
+		for (auto& channelOsc : channelOscs) {
+			channelOsc.setSampleRate(sampleRate);
+		}
+		changeChannelLayout({ 1, {}, {} });
+	}
+
+	// UI thread only!
+	void changeChannelLayout(ChannelLayout&& newLayout) {
+		newLayout.numChannels = std::clamp(newLayout.numChannels, 0, static_cast<int>(channelOscs.size()));
+		auto newSharedLayout = std::make_shared<ChannelLayout>(std::move(newLayout));
+		layoutReleasePool.add(newSharedLayout);
+		layoutHandoff.publish(std::move(newSharedLayout));
+		layoutReleasePool.clearUnused();
+	}
+
+	/// Samples processed so far, i.e. the sample time of the next block. Any thread.
+	int64_t getSampleTime() const {
+		return sampleTime.load(std::memory_order_acquire);
 	}
 
 	//=====================================
@@ -59,29 +153,196 @@ public:
 	//=====================================
 
 	// Audio thread
-	void process(c74::min::audio_bundle& buffer) {
-		auto newState = std::atomic_load(&currentState);
-		if (previousState != newState.get()) {
-			previousState = newState.get();
-			waveforms.clear();
-			assert(waveforms.capacity() >= newState->size());
-			for (const auto& multitable : *newState) {
-				waveforms.push_back(make_span(multitable.begin(), multitable.end()));
+	void process(c74::min::audio_bundle& buffer, const SignalInputs& signals = {}) {
+		auto* outputLeft = buffer.samples(0);
+		auto* outputRight = buffer.channel_count() > 1 ? buffer.samples(1) : nullptr;
+		processSplitAtEvents(static_cast<int>(buffer.frame_count()), [&](int offset, int n) {
+			render(outputLeft + offset, outputRight ? outputRight + offset : nullptr, n, signals.advancedBy(offset));
+		});
+	}
+
+	// Audio thread
+	/// @brief Renders one channel of buffer per oscillator of the channel layout, block by block, so all channels read
+	/// the tables while they are in cache. See enableChannels().
+	/// @param frequencySignals  frequency in Hz per channel, replacing the frequency and its offset, nullptr if not connected.
+	///                          Channels above numFrequencySignals wrap around.
+	void processChannels(c74::min::audio_bundle& buffer, const c74::min::sample* const* frequencySignals = nullptr, int numFrequencySignals = 0) {
+		if (auto* newLayout = layoutHandoff.acquire(); newLayout != layout) {
+			layout = newLayout;
+			updateChannels();
+		}
+		const int numChannels = layout ? std::min(layout->numChannels, static_cast<int>(buffer.channel_count())) : 0;
+		for (int c = numChannels; c < static_cast<int>(buffer.channel_count()); ++c) {
+			std::fill_n(buffer.samples(c), buffer.frame_count(), 0.);
+		}
+		processSplitAtEvents(static_cast<int>(buffer.frame_count()), [&](int offset, int n) {
+			renderChannels(buffer, numChannels, offset, n, frequencySignals, numFrequencySignals);
+		});
+	}
+
+private:
+	static constexpr int maxPendingEvents = 64;
+
+	// Applies the frames state and the events, and calls render(offset, n) for the samples between the queued events
+	template<class F>
+	void processSplitAtEvents(int frameCount, F&& render) {
+		auto* newState = stateHandoff.acquire();
+		if (previousState != newState) {
+			previousState = newState;
+			osc.setWaveforms(newState->waveforms, newState->gains);
+			for (auto& channelOsc : channelOscs) {
+				channelOsc.setWaveforms(newState->waveforms, newState->gains);
 			}
-			osc.setWaveforms(waveforms);
 		}
-		Event event; //Allocation in process function? -> I would go with atomic<double> value.store() & value.load()
+		Event event;
 		while (eventQueue.try_dequeue(event)) {
-			processEvent(event);
+			schedule(event);
 		}
 
-		for (auto i = 0; i < buffer.frame_count(); ++i) {
-			buffer.samples(0)[i] = ++osc * ++gain;
-			frequency++;
+		// Latest immediate values first, e.g. the number of voices before the notes queued with it
+		parameters.consume([this](size_t slot, double value) { processEvent({ static_cast<ParameterType>(slot), value }); });
+
+		// The block is split at the queued events, so each one takes effect at its sample, overdue ones at the start
+		const auto blockStart = sampleTime.load(std::memory_order_relaxed);
+		int offset = 0;
+		while (offset < frameCount) {
+			while (numPending > 0 && pendingEvents[0].time <= blockStart + offset) {
+				processEvent(popPending());
+			}
+			int end = frameCount;
+			if (numPending > 0) {
+				end = static_cast<int>(std::min<int64_t>(end, pendingEvents[0].time - blockStart));
+			}
+			render(offset, end - offset);
+			offset = end;
 		}
+		sampleTime.store(blockStart + frameCount, std::memory_order_release);
+	}
+
+	void renderChannels(c74::min::audio_bundle& buffer, int numChannels, int frameOffset, int frameCount,
+		const c74::min::sample* const* frequencySignals, int numFrequencySignals) {
+		for (int offset = frameOffset; offset < frameOffset + frameCount; offset += MorphingBlockOscillator::blockSize) {
+			const int n = std::min(frameOffset + frameCount - offset, MorphingBlockOscillator::blockSize);
+			for (int i = 0; i < n; ++i) {
+				gainBuffer[i] = static_cast<float>(++gain);
+			}
+			for (int c = 0; c < numChannels; ++c) {
+				const auto* frequencySignal = numFrequencySignals > 0 ? frequencySignals[c % numFrequencySignals] + offset : nullptr;
+				channelOscs[c].process(oscBuffer.data(), oscBufferRight.data(), n, nullptr, frequencySignal);
+				auto* output = buffer.samples(c) + offset;
+				for (int i = 0; i < n; ++i) {
+					output[i] = oscBuffer[i] * gainBuffer[i];
+				}
+			}
+		}
+	}
+
+	void updateChannels() {
+		if (!layout) { return; }
+		for (int c = 0; c < layout->numChannels; ++c) {
+			if (previousState) { channelOscs[c].setWaveforms(previousState->waveforms, previousState->gains); }
+		}
+		updateChannelFrequencies();
+		updateChannelMorphs();
+	}
+
+	// a parameter only touches its own setting, re-sending the morph position must not restart a glide
+	void updateChannelFrequencies() {
+		if (!layout) { return; }
+		for (int c = 0; c < layout->numChannels; ++c) {
+			channelOscs[c].setFrequency(frequency * layout->frequencyRatios[c]);
+		}
+	}
+
+	void updateChannelMorphs() {
+		if (!layout) { return; }
+		for (int c = 0; c < layout->numChannels; ++c) {
+			channelOscs[c].setNormalizedMorphingParam(morphPos + layout->morphOffsets[c]);
+		}
+	}
+
+	// outputRight may be nullptr
+	void render(c74::min::sample* outputLeft, c74::min::sample* outputRight, int frameCount, const SignalInputs& signals) {
+		for (int offset = 0; offset < frameCount; offset += MorphingBlockOscillator::blockSize) {
+			const int n = std::min(frameCount - offset, MorphingBlockOscillator::blockSize);
+			const auto blockSignals = signals.advancedBy(offset);
+			if (oversampling > 1) {
+				renderOversampled(n, blockSignals, outputRight != nullptr);
+			} else {
+				renderBlock(oscBuffer.data(), oscBufferRight.data(), n, blockSignals.morph, blockSignals.frequency, blockSignals.sync);
+			}
+			for (int i = 0; i < n; ++i) {
+				const auto g = ++gain;
+				outputLeft[offset + i] = oscBuffer[i] * g;
+				if (outputRight) { outputRight[offset + i] = oscBufferRight[i] * g; }
+			}
+		}
+	}
+
+	void renderBlock(float* outLeft, float* outRight, int n, const double* morphSignal, const double* frequencySignal, const double* syncSignal) {
+		if (voices.getNumVoices() > 0) {
+			osc.processVoices(outLeft, outRight, n, voices, morphSignal);
+		} else {
+			osc.process(outLeft, outRight, n, morphSignal, frequencySignal, syncSignal);
+		}
+	}
+
+	// Renders n * oversampling samples and decimates them into oscBuffer. The signal inlets are held for oversampling
+	// samples each, except the sync signal: it is interpolated, so its zero crossings stay where they are.
+	void renderOversampled(int n, const SignalInputs& signals, bool stereo) {
+		const int count = n * oversampling;
+		auto hold = [&](const c74::min::sample* signal, std::array<double, oversampledSize>& held) -> const double* {
+			if (!signal) { return nullptr; }
+			for (int i = 0; i < count; ++i) {
+				held[i] = signal[i / oversampling];
+			}
+			return held.data();
+		};
+		const double* syncSignal{};
+		if (signals.sync) {
+			for (int i = 0; i < count; ++i) {
+				const double previous = i < oversampling ? previousSync : signals.sync[i / oversampling - 1];
+				const double fraction = static_cast<double>(i % oversampling + 1) / oversampling;
+				interpolatedSync[i] = previous + (signals.sync[i / oversampling] - previous) * fraction;
+			}
+			previousSync = signals.sync[n - 1];
+			syncSignal = interpolatedSync.data();
+		}
+		renderBlock(oversampledLeft.data(), oversampledRight.data(), count,
+			hold(signals.morph, heldMorph), hold(signals.frequency, heldFrequency), syncSignal);
+		decimate(oversampledLeft.data(), oscBuffer.data(), n, decimators.data());
+		if (stereo) { decimate(oversampledRight.data(), oscBufferRight.data(), n, decimators.data() + 2); }
+	}
+
+	// One half-band stage per factor of two, stages[0] runs at the highest rate
+	void decimate(const float* in, float* out, int n, HalfbandDecimator* stages) {
+		if (oversampling == 4) {
+			stages[0].process(in, decimatorBuffer.data(), 2 * n);
+			stages[1].process(decimatorBuffer.data(), out, n);
+		} else {
+			stages[0].process(in, out, n);
+		}
+	}
+
+	// Keeps the pending events sorted by time, events with the same time in order of arrival
+	void schedule(const Event& event) {
+		if (numPending == maxPendingEvents) {
+			processEvent(popPending()); // early rather than lost
+		}
+		const auto end = pendingEvents.begin() + numPending;
+		const auto pos = std::upper_bound(pendingEvents.begin(), end, event.time, [](int64_t time, const Event& e) { return time < e.time; });
+		std::move_backward(pos, end, end + 1);
+		*pos = event;
+		++numPending;
+	}
+
+	Event popPending() {
+		const auto event = pendingEvents[0];
+		std::move(pendingEvents.begin() + 1, pendingEvents.begin() + numPending, pendingEvents.begin());
+		--numPending;
+		return event;
 	}
 
-private:
 	void processEvent(const Event& event) {
 		switch (event.parameterType) {
 		case ParameterType::gain:
@@ -96,6 +357,33 @@ private:
 		case ParameterType::sampleRate:
 			setSampleRate(event.value);
 			break;
+		case ParameterType::numVoices:
+			voices.setNumVoices(static_cast<int>(event.value));
+			break;
+		case ParameterType::unisonVoices:
+			unison.numVoices = static_cast<int>(event.value);
+			updateUnison();
+			break;
+		case ParameterType::unisonDetune:
+			unison.detuneCents = static_cast<float>(event.value);
+			updateUnison();
+			break;
+		case ParameterType::unisonWidth:
+			unison.width = static_cast<float>(event.value);
+			updateUnison();
+			break;
+		case ParameterType::oversampling:
+			setOversampling(static_cast<int>(event.value));
+			break;
+		case ParameterType::morphGlide:
+			osc.setMorphGlide(static_cast<int>(event.value));
+			for (auto& channelOsc : channelOscs) {
+				channelOsc.setMorphGlide(static_cast<int>(event.value));
+			}
+			break;
+		case ParameterType::note:
+			voices.noteOn(static_cast<int>(event.value), event.velocity, event.morph);
+			break;
 		}
 	}
 
@@ -104,25 +392,79 @@ private:
 	}
 
 	void setFrequency(double frequency) {
-		this->frequency.set(frequency);
+		this->frequency = frequency;
 		osc.setFrequency(frequency);
+		updateChannelFrequencies();
 	}
 
 	void setMorphPos(double morphPos) {
+		this->morphPos = morphPos;
 		osc.setNormalizedMorphingParam(morphPos);
+		updateChannelMorphs();
 	}
 
 	void setSampleRate(double sampleRate) {
-		osc.setSampleRate(sampleRate);
+		this->sampleRate = sampleRate;
+		osc.setSampleRate(sampleRate * oversampling);
+		for (auto& channelOsc : channelOscs) {
+			channelOsc.setSampleRate(sampleRate);
+		}
+	}
+
+	// 1, 2 or 4, render() only
+	void setOversampling(int factor) {
+		factor = factor >= 4 ? 4 : factor >= 2 ? 2 : 1;
+		if (factor == oversampling) { return; }
+		oversampling = factor;
+		osc.setSampleRate(sampleRate * oversampling);
+		for (auto& decimator : decimators) {
+			decimator.reset();
+		}
 	}
 
+	void updateUnison() {
+		osc.setUnison(unison.numVoices, unison.detuneCents, unison.width);
+		for (auto& channelOsc : channelOscs) {
+			channelOsc.setUnison(unison.numVoices, unison.detuneCents, unison.width);
+		}
+	}
+
+
+	MorphingBlockOscillator osc;
+	VoiceBank voices;		// polyphonic mode with at least one voice, osc renders them all
+	alignas(32) std::array<float, MorphingBlockOscillator::blockSize> oscBuffer{};
+	alignas(32) std::array<float, MorphingBlockOscillator::blockSize> oscBufferRight{};
+
+	// oversampled rendering, the channel oscillators always run at the sample rate
+	static constexpr int oversampledSize = MorphingBlockOscillator::blockSize * maxOversampling;
+	int oversampling{ 1 };
+	alignas(32) std::array<float, oversampledSize> oversampledLeft{};
+	alignas(32) std::array<float, oversampledSize> oversampledRight{};
+	std::array<double, oversampledSize> heldMorph{}, heldFrequency{}, interpolatedSync{};
+	double previousSync{};
+	std::array<float, MorphingBlockOscillator::blockSize * 2> decimatorBuffer{};
+	std::array<HalfbandDecimator, 4> decimators;	// left stages, then right stages
+	struct
+	{
+		int numVoices{ 1 };
+		float detuneCents{}, width{};
+	} unison;
+	double sampleRate{ 48000. }, frequency{}, morphPos{};
+	RampedValue<double> gain{ 1. };
+	alignas(32) std::array<float, MorphingBlockOscillator::blockSize> gainBuffer{};
 
-	MorphingWavetableOscillator<WavetableOscillator<Wavetable<float>>> osc;
-	std::vector<std::span<const Wavetable<float>>> waveforms;
-	RampedValue<double> gain{ 1. }, frequency{ 10. }; //Probably not needed
-	std::shared_ptr<State> currentState{};
+	// multichannel variant only, channelOscs is allocated once by enableChannels()
+	std::vector<MorphingBlockOscillator> channelOscs;
+	StateHandoff<ChannelLayout> layoutHandoff;
+	ChannelLayout* layout{};
+	ReleasePool<ChannelLayout> layoutReleasePool;
+	StateHandoff<State> stateHandoff;
 	State* previousState{};
-	ReleasePool<MultitableCollection> releasePool;
-	c74::min::fifo<Event> eventQueue{ 16 };
+	ReleasePool<State> releasePool;
+	ParameterStore<static_cast<size_t>(ParameterType::numStoredParameters)> parameters;
+	c74::min::fifo<Event> eventQueue{ maxPendingEvents };	// timed events only
+	std::array<Event, maxPendingEvents> pendingEvents{};	// audio thread only, sorted by time
+	int numPending{};
+	std::atomic<int64_t> sampleTime{};
 };
 }
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include "frame_tables.h"
+
+namespace Butterfly {
+
+/// @brief Band tables synthesized from spectral frames, least recently used first out. Main thread only.
+/// Tables that are still in use (held by a frame or a published state) are never evicted, the others are kept
+/// up to the capacity, so an oscillator moving back into bands it played before takes them from the cache.
+class BandCache
+{
+public:
+	struct Key
+	{
+		uint64_t spectrumId{};				// SpectralFrame::getId()
+		float sampleRate{};
+		std::pair<size_t, size_t> bands;	// [first, last]
+
+		bool operator==(const Key&) const = default;
+	};
+
+	/// @param capacity  bytes of tables that are not in use
+	explicit BandCache(size_t capacity) : capacity(capacity) {}
+
+	/// Cached tables for key or nullptr, marks them as recently used
+	std::shared_ptr<const FrameTables> find(const Key& key) {
+		const auto it = index.find(key);
+		if (it == index.end()) { return nullptr; }
+		entries.splice(entries.begin(), entries, it->second);
+		return it->second->tables;
+	}
+
+	void insert(const Key& key, std::shared_ptr<const FrameTables> tables) {
+		if (const auto it = index.find(key); it != index.end()) {
+			entries.erase(it->second);
+			index.erase(it);
+		}
+		entries.push_front({ key, std::move(tables) });
+		index.emplace(key, entries.begin());
+	}
+
+	void setCapacity(size_t bytes) {
+		capacity = bytes;
+		trim();
+	}
+
+	/// Evicts the least recently used tables that are not in use until the rest fits into the capacity.
+	/// Not done by insert(), so tables can be inserted before a frame takes them. Call it once they have been taken.
+	void trim() {
+		size_t bytes{};
+		for (auto it = entries.begin(); it != entries.end();) {
+			if (isInUse(*it)) {
+				++it;
+			} else if (bytes + it->tables->sizeInBytes() <= capacity) {
+				bytes += it->tables->sizeInBytes();
+				++it;
+			} else {
+				index.erase(it->key);
+				it = entries.erase(it);
+			}
+		}
+	}
+
+	/// Memory of the cached tables that are not in use
+	size_t unusedBytes() const {
+		size_t bytes{};
+		for (const auto& entry : entries) {
+			if (!isInUse(entry)) { bytes += entry.tables->sizeInBytes(); }
+		}
+		return bytes;
+	}
+
+	size_t size() const { return entries.size(); }
+
+private:
+	struct Entry
+	{
+		Key key;
+		std::shared_ptr<const FrameTables> tables;
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const {
+			size_t hash = std::hash<uint64_t>{}(key.spectrumId);
+			for (const size_t value : { std::hash<float>{}(key.sampleRate), key.bands.first, key.bands.second }) {
+				hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+			}
+			return hash;
+		}
+	};
+
+	static bool isInUse(const Entry& entry) { return entry.tables.use_count() > 1; }
+
+	size_t capacity{};
+	std::list<Entry> entries;		// most recently used first
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+};
+
+}
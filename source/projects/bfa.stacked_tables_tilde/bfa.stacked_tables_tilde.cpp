@@ -9,6 +9,7 @@
 #include "waveform_processing.h"
 
 #include "stacked_frames.h"
+#include "async_frame_builder.h"
 
 /*
 #define INTERNAL_TABLESIZE 2048
@@ -20,7 +21,14 @@ inline constexpr int internalTablesize = 2048;
 using namespace c74::min;
 using namespace c74::min::ui;
 
-class stacked_tables_tilde : public object<stacked_tables_tilde>, public vector_operator<>, public ui_operator<160, 160>
+//bfa.stacked_tables.mc~ is built from this file with BFA_STACKED_TABLES_MC defined, see its CMakeLists.txt
+#ifdef BFA_STACKED_TABLES_MC
+using stacked_tables_operator = mc_operator<>;
+#else
+using stacked_tables_operator = vector_operator<>;
+#endif
+
+class stacked_tables_tilde : public object<stacked_tables_tilde>, public stacked_tables_operator, public ui_operator<160, 160>
 {
 private:
     int nIntervalls;
@@ -29,11 +37,23 @@ private:
     
     float sampleRate{48000.f};
 
-    static constexpr int internalTablesize{2048};   //Die wollen wir nicht ändern. Als Konstante außerhalb der Klasse definieren?
-    static constexpr int maxFrames{16};             //Die wollen wir nicht ändern. Als Konstante außerhalb der Klasse definieren?
+    //Declared before stackedFrames and frameBuilder: destroyed after their jobs have finished, see ThreadPoolUser
+    Butterfly::ThreadPoolUser threadPoolUser;
+
+    static constexpr int defaultTablesize{2048};    //See internal_tablesize
+    static constexpr int maxFrames{256};            //Upper limit only, see memory_budget
     
     std::vector<float> splitFreqs;
-    const Butterfly::FFTCalculator<float, internalTablesize> fftCalculator;
+    
+    //Adopts spectral bands synthesized in the background. Declared before stackedFrames, which waits for its jobs on destruction
+    queue<> commit_bands {
+        this, MIN_FUNCTION {
+            stackedFrames.collectSpectralBands([this](const std::string& error) {
+                cerr << "band synthesis failed: " << error << endl;
+            });
+            return{};
+        }
+    };
     
     Butterfly::StackedFrames stackedFrames;
 
@@ -46,9 +66,19 @@ public:
     MIN_AUTHOR          { "BFA_JK" };
     MIN_RELATED         { "index~, buffer~, wave~, wavetable~" };
 
+#ifdef BFA_STACKED_TABLES_MC
+    inlet<>  message_in      { this, "(multichannelsignal) Frequency in Hz per channel, replaces set_freq and frequency_offsets while connected. Messages in."};
+    outlet<> message_out     { this, "(message) Messages out."};
+    outlet<> output          { this, "(multichannelsignal) One oscillator per channel, see chans.", "multichannelsignal"};
+#else
     inlet<>  message_in      { this, "(message) Messages in."};
+    inlet<>  morph_in        { this, "(signal) Morph position 0..1 per sample, replaces morph_position while connected.", "signal"};
+    inlet<>  freq_in         { this, "(signal) Frequency in Hz per sample (pitch, FM), replaces set_freq while connected.", "signal"};
+    inlet<>  sync_in         { this, "(signal) Hard sync, restarts the waveform where the signal crosses zero upwards. Not with voices or unison.", "signal"};
     outlet<> message_out     { this, "(message) Messages out."};
-    outlet<> output          { this, "(signal) Synthesized wavetable signal out.", "signal"};
+    outlet<> output          { this, "(signal) Synthesized wavetable signal out, left channel.", "signal"};
+    outlet<> output_right    { this, "(signal) Right channel, differs from the left one with unison_width only.", "signal"};
+#endif
     
     buffer_reference input_buffer { this,                   //Constructor of buffer reference before input_buffer_name attribute
         MIN_FUNCTION {                                      // will receive a symbol arg indicating 'binding', 'unbinding', or 'modified'
@@ -69,7 +99,61 @@ public:
     attribute<color> selection_color {this, "Selection Color", {.8f, .8f, .8f, .8f}};
     attribute<color> morphed_frame_color {this, "Morphed Frame Color", {1.f, 1.f, 1.f, 1.f}};
     attribute<bool> use_fat_lines_for_selection {this, "Draw selected waveforms fat", false};
-    attribute<int> rampSteps {this, "Ramp steps per wavetable", 15000};
+    attribute<int> rampSteps {
+        this, "Ramp steps per wavetable", 15000,
+        setter { MIN_FUNCTION {
+            const int samplesPerFrame = std::max(static_cast<int>(args[0]), 1);
+            stackedFrames.setMorphGlide(samplesPerFrame);
+            return { samplesPerFrame };
+        }},
+        description {"Samples the morph position takes to glide across one frame. Jumps across several frames crossfade directly between the frames next to the start and the target."}
+    };
+    
+    attribute<int> internal_tablesize {
+        this, "internal_tablesize", defaultTablesize,
+        setter { MIN_FUNCTION {
+            const int tablesize = args[0];
+            if (!Butterfly::isSupportedTablesize(tablesize)) {
+                cout << "Internal tablesize has to be 256, 512, 1024, 2048, 4096 or 8192.\n";
+                return { static_cast<int>(stackedFrames.getInternalTablesize()) };
+            }
+            stackedFrames.setInternalTablesize(tablesize);
+            return { tablesize };
+        }},
+        description {"Table size of the frames (256 to 8192). Buffers added with add_frame must have this size, existing frames are resampled."}
+    };
+    
+    attribute<double> memory_budget {
+        this, "memory_budget", 32.,
+        setter { MIN_FUNCTION {
+            const double megabytes = std::max(static_cast<double>(args[0]), 0.);
+            stackedFrames.setMemoryBudget(static_cast<size_t>(megabytes * 1024. * 1024.));
+            warnIfOverMemoryBudget();
+            return { megabytes };
+        }},
+        description {"Memory in MB for the frames' tables and spectra (see memory_usage). Frames that don't fit are stored as spectra with the bands that are played (see storage)."}
+    };
+    
+    attribute<symbol> storage {
+        this, "storage", "tables",
+        setter { MIN_FUNCTION {
+            const symbol mode = args[0];
+            stackedFrames.setStorageMode(mode == "spectral" ? Butterfly::StorageMode::spectral : Butterfly::StorageMode::tables);
+            return args;
+        }},
+        description {"tables: all bands are rendered when a frame is added. spectral: frames are stored as harmonic spectra, bands are synthesized in the background for the frequencies that are played (set_freq, notes and frequency_range) and cached."},
+        range {"tables", "spectral"}
+    };
+    
+    attribute<numbers> frequency_range {
+        this, "frequency_range", {{0.0, 0.0}},
+        setter { MIN_FUNCTION {
+            stackedFrames.setFrequencyRange(static_cast<float>(args[0]), static_cast<float>(args[1]));
+            warnIfOverMemoryBudget();
+            return args;
+        }},
+        description {"Lowest and highest frequency of the frequency signal with spectral storage, outside of it the nearest synthesized band plays. 0 0: no frequency signal, the bands follow set_freq and the notes."}
+    };
     
     attribute<int, threadsafe::no, limit::clamp> m_channel {
         this, "Channel", 1,
@@ -89,21 +173,131 @@ public:
         this, "Export tablesize", 1048, description{"Default export tablesize."}
     };
     
+    attribute<symbol> export_quality {
+        this, "export_quality", "normal",
+        description {"Resampling quality of export_table: draft, normal or high."},
+        range {"draft", "normal", "high"}
+    };
+    
     //Attribute könnte man threadsafe=yes setzen und sich vrmtl. die Queue sparen
+    attribute<int> voices {
+        this, "voices", 0,
+        setter { MIN_FUNCTION {
+            const int numVoices = std::clamp(static_cast<int>(args[0]), 0, Butterfly::VoiceBank::maxVoices);
+            stackedFrames.setNumVoices(numVoices);
+            warnIfSyncIgnored(numVoices, unison);
+            return { numVoices };
+        }},
+        description {"Number of voices for the note message, 0 plays one oscillator at the set_freq frequency."},
+        range {0, Butterfly::VoiceBank::maxVoices}
+    };
+    
+    attribute<int> unison {
+        this, "unison", 1,
+        setter { MIN_FUNCTION {
+            const int numVoices = std::clamp(static_cast<int>(args[0]), 1, Butterfly::MorphingBlockOscillator::maxUnisonVoices);
+            stackedFrames.setUnisonVoices(numVoices);
+            warnIfSyncIgnored(voices, numVoices);
+            return { numVoices };
+        }},
+        description {"Number of detuned copies of the oscillator, rendered side by side. Not applied to the voices of the note message."},
+        range {1, Butterfly::MorphingBlockOscillator::maxUnisonVoices}
+    };
+    
+    attribute<double> unison_detune {
+        this, "unison_detune", 10.,
+        setter { MIN_FUNCTION {
+            stackedFrames.setUnisonDetune(args[0]);
+            return args;
+        }},
+        description {"Detune of the outermost unison copies in cent."}
+    };
+    
+    attribute<double> unison_width {
+        this, "unison_width", 0.5,
+        setter { MIN_FUNCTION {
+            stackedFrames.setUnisonWidth(args[0]);
+            return args;
+        }},
+        description {"Stereo width of the unison copies, 0..1."},
+        range {0., 1.}
+    };
+    
+    attribute<int> oversampling {
+        this, "oversampling", 1,
+        setter { MIN_FUNCTION {
+            const int factor = static_cast<int>(args[0]) >= 4 ? 4 : static_cast<int>(args[0]) >= 2 ? 2 : 1;
+            stackedFrames.setOversampling(factor);
+            return { factor };
+        }},
+        description {"Renders at 1, 2 or 4 times the sample rate and decimates, against aliasing of fast modulation. Costs as many times the CPU, not applied by bfa.stacked_tables.mc~."},
+        range {1, 2, 4}
+    };
+    
     attribute<double> oscillatorFreq {
         this, "Osc Freq", 77.78, description{"Oscillator Frequency."}
     };
          
 
-    stacked_tables_tilde(const atoms& args = {}) : ui_operator::ui_operator {this, args}, stackedFrames{sampleRate, internalTablesize, static_cast<float>(oscillatorFreq.get()), maxFrames} {
-        splitFreqs = Butterfly::calculateSplitFreqs(2.f, sampleRate / 2.f, 5.f);
+    stacked_tables_tilde(const atoms& args = {}) : ui_operator::ui_operator {this, args}, stackedFrames{sampleRate, defaultTablesize, static_cast<float>(oscillatorFreq.get()), maxFrames, [this] { commit_bands.set(); }} {
+        splitFreqs = stackedFrames.getSplitFreqs();
         nIntervalls = splitFreqs.size();
+#ifdef BFA_STACKED_TABLES_MC
+        stackedFrames.enableChannels();
+        updateChannelLayout();
+#endif
     }
     
+#ifdef BFA_STACKED_TABLES_MC
+    std::vector<float> frequencyOffsets, morphOffsets;
+    
+    attribute<int> chans {
+        this, "chans", 2,
+        setter { MIN_FUNCTION {
+            return { std::clamp(static_cast<int>(args[0]), 1, Butterfly::AudioProcessor::maxChannels) };
+        }},
+        description {"Number of output channels. Takes effect when the audio is restarted."},
+        range {1, Butterfly::AudioProcessor::maxChannels}
+    };
+    
+    //List of cents, one per channel, the last one repeats
+    message<> frequency_offsets {
+        this, "frequency_offsets", "Frequency offset of each channel in cents.", MIN_FUNCTION {
+            frequencyOffsets.clear();
+            for (const auto& offset : args) { frequencyOffsets.push_back(static_cast<float>(offset)); }
+            updateChannelLayout();
+            return{};
+        }
+    };
+    
+    //List of offsets to the morph position, one per channel, the last one repeats
+    message<> morph_offsets {
+        this, "morph_offsets", "Morph position offset of each channel.", MIN_FUNCTION {
+            morphOffsets.clear();
+            for (const auto& offset : args) { morphOffsets.push_back(static_cast<float>(offset)); }
+            updateChannelLayout();
+            return{};
+        }
+    };
+    
+    //Channel count of the multichannel outlet, queried by Max when the audio starts
+    message<> multichanneloutputs {
+        this, "multichanneloutputs", MIN_FUNCTION {
+            updateChannelLayout();
+            return { chans.get() };
+        }
+    };
+    
+    void updateChannelLayout() {
+        stackedFrames.setChannelLayout(chans.get(), frequencyOffsets, morphOffsets);
+    }
+#endif
+    
     message<> dspsetup {
         this, "dspsetup", MIN_FUNCTION {
             sampleRate = static_cast<float>(args[0]);
             stackedFrames.setSampleRate(sampleRate);
+            warnIfSyncIgnored(voices, unison);
             cout << "dspsetup happend" << endl;
             return {};
         }
@@ -119,27 +313,57 @@ public:
                 return{};
             }
             if (!buf.valid()) { return{}; }
-            if(!(buf.frame_count() == internalTablesize)) {
-                cout << "Buffer size has to be 2048 samples.\n";
+            if(!(buf.frame_count() == static_cast<size_t>(internal_tablesize.get()))) {
+                cout << "Buffer size has to be " << internal_tablesize.get() << " samples.\n";
+                return{};
+            }
+            if (stackedFrames.getNumFrames() + frameBuilder.numPending() >= maxFrames) {
+                message_out.send("userPromt", "Max frame count reached");    //Das dem Nutzer prompten
                 return{};
             }
             std::vector<float> data;
             for (auto i = 0; i < buf.frame_count(); i++){
                 data.push_back(buf.lookup(i, chan));
             }
+            buf.dirty();
             
-            if (stackedFrames.addFrame(data, sampleRate, splitFreqs, fftCalculator)){
-                cout << "Frame succesfully added.\n";
+            //Antialiasing and band synthesis run in the background, commit_frames adds the frame on the main thread
+            if (storage.get() == "spectral") {
+                frameBuilder.submit([data = std::move(data), sampleRate = sampleRate, splitFreqs = splitFreqs, bands = stackedFrames.getSpectralBands()] {
+                    return Butterfly::createSpectralFrame(data, splitFreqs, sampleRate, bands);
+                });
             } else {
-                message_out.send("userPromt", "Max frame count reached");    //Das dem Nutzer prompten
+                frameBuilder.submit([data = std::move(data), sampleRate = sampleRate, splitFreqs = splitFreqs] {
+                    return Butterfly::createFrame(data, sampleRate, splitFreqs);
+                });
             }
+            message_out.send("add_frame", "pending", frameBuilder.numPending());
+            return{};
+        }
+    };
+    
+    queue<> commit_frames {
+        this, MIN_FUNCTION {
+            frameBuilder.collect([this](Butterfly::Frame&& frame) {
+                if (stackedFrames.addFrame(std::move(frame))) {
+                    message_out.send("add_frame", "done", frameBuilder.numPending());
+                } else {
+                    message_out.send("userPromt", "Max frame count reached");
+                }
+            }, [this](const std::string& error) {
+                cerr << "add_frame failed: " << error << endl;
+                message_out.send("add_frame", "failed", frameBuilder.numPending());
+            });
+            warnIfOverMemoryBudget();
             notifyStackedTablesStatus();
             redraw();
-            buf.dirty();
             return{};
         }
     };
     
+    //Declared after commit_frames: waits for running jobs before commit_frames is destroyed
+    Butterfly::AsyncFrameBuilder frameBuilder { [this] { commit_frames.set(); } };
+    
     message<> flip_phase {
         this, "flip_phase", MIN_FUNCTION {
             stackedFrames.flipPhase();
@@ -204,9 +428,10 @@ public:
         }
     };
     
+    //Optional second argument: delay in ms, applied sample-accurately
     message<> morph_position {
         this, "morph_position", MIN_FUNCTION {
-            stackedFrames.setNormalizedMorphPos(static_cast<float>(args[0]));
+            stackedFrames.setNormalizedMorphPos(static_cast<float>(args[0]), eventTime(args));
             redraw();
             return{};
         }
@@ -215,14 +440,31 @@ public:
     message<> set_freq {
         this, "set_freq", MIN_FUNCTION {
             oscillatorFreq = std::clamp(static_cast<double>(args[0]), 1., static_cast<double>(sampleRate) / 2.);
-            stackedFrames.setOscFreq(oscillatorFreq.get());
+            stackedFrames.setOscFreq(oscillatorFreq.get(), eventTime(args));
+            return{};
+        }
+    };
+    
+    //note <pitch> <velocity> [delay in ms] [morph position], velocity 0 is a note off
+    message<> note {
+        this, "note", "Play a MIDI note on one of the voices, optionally at a morph position of its own.", MIN_FUNCTION {
+            if (args.size() < 2) { return{}; }
+            const float morph = args.size() > 3 ? static_cast<float>(args[3]) : Butterfly::VoiceBank::sharedMorph;
+            stackedFrames.playNote(static_cast<int>(args[0]), static_cast<float>(args[1]), eventTime(args, 2), morph);
+            return{};
+        }
+    };
+    
+    message<> memory_usage {
+        this, "memory_usage", "Report the memory held by the band-limited tables in bytes.", MIN_FUNCTION {
+            message_out.send("memory_usage", stackedFrames.getTablesSizeInBytes());
             return{};
         }
     };
     
     message<> set_output_gain {
         this, "set_output_gain", MIN_FUNCTION {
-            stackedFrames.setOscGain(std::clamp(static_cast<double>(args[0]), 0., 1.));
+            stackedFrames.setOscGain(std::clamp(static_cast<double>(args[0]), 0., 1.), eventTime(args));
             return{};
         }
     };
@@ -236,14 +478,13 @@ public:
     
     message<> export_table {
         this, "export_table", MIN_FUNCTION {
-            if (auto concatenatedFrames = stackedFrames.getConcatenatedFrames(export_tablesize.get())) {
-                message_out("export_buffer_length", concatenatedFrames->size());    //set outbut buffer~ size in Max
+            const auto exportSize = stackedFrames.getExportSize(export_tablesize.get());
+            if (exportSize > 0) {
+                message_out("export_buffer_length", exportSize);    //set outbut buffer~ size in Max
                 output_buffer.set(output_buffer_name);
                 buffer_lock<false> buf(output_buffer);      //false: not accessing via audio thread
-                if (buf.valid()) {
-                    for (int i = 0; i < buf.frame_count(); i++) {
-                        buf[i] = concatenatedFrames->at(i);
-                    }
+                if (buf.valid() && buf.channel_count() == 1 && buf.frame_count() >= exportSize) {
+                    stackedFrames.exportFrames(&buf[0], export_tablesize.get(), resamplerQuality());   //Resampled in parallel, straight into the buffer~
                     message_out("exporting_done");
                 } else {
                     message_out("debug", "Output bufer not valid.");
@@ -256,6 +497,33 @@ public:
         }
     };
     
+    //Without a delay argument the event is applied at the start of the next signal vector
+    int64_t eventTime(const atoms& args, size_t delayIndex = 1) {
+        return args.size() > delayIndex ? stackedFrames.sampleTimeIn(static_cast<double>(args[delayIndex])) : Butterfly::Event::immediate;
+    }
+    
+    //Hard sync only restarts the single oscillator, the voices and unison copies keep running
+    void warnIfSyncIgnored(int numVoices, int numUnisonVoices) {
+#ifndef BFA_STACKED_TABLES_MC
+        if (sync_in.has_signal_connection() && (numVoices > 0 || numUnisonVoices > 1)) {
+            cerr << "Hard sync is ignored with voices or unison." << endl;
+        }
+#endif
+    }
+    
+    void warnIfOverMemoryBudget() {
+        if (stackedFrames.exceedsMemoryBudget()) {
+            cerr << "memory_budget is too small for the spectra and the bands that are played (" << stackedFrames.getTablesSizeInBytes() << " bytes)." << endl;
+        }
+    }
+    
+    Butterfly::ResamplerQuality resamplerQuality() {
+        const symbol quality = export_quality;
+        if (quality == "draft") { return Butterfly::ResamplerQuality::draft; }
+        if (quality == "high") { return Butterfly::ResamplerQuality::high; }
+        return Butterfly::ResamplerQuality::normal;
+    }
+    
     //Relevant for UI activation states
     void notifyStackedTablesStatus() {
         size_t numFrames = stackedFrames.getNumFrames();
@@ -297,7 +565,8 @@ public:
             float origin_y = (frameSamples->at(0) * yScaling * -1.f) + yOffset;
             float position = 0.f;
             float width = t.width() - margin;
-            float frac     = static_cast<float>(internalTablesize) / width;
+            const int tablesize = static_cast<int>(frameSamples->size());
+            float frac     = static_cast<float>(tablesize) / width;
             auto selectedIdx = stackedFrames.getSelectedFrameIdx();
             if (selectedIdx && frameIdx == selectedIdx) {
                  if (use_fat_lines_for_selection) {
@@ -310,7 +579,7 @@ public:
             for (int i = 0; i < width; i++) {
                 int lower_index = floor(position);
                 int upper_index = ceil(position);
-                upper_index = upper_index > (internalTablesize - 1) ? (internalTablesize - 1) : upper_index;
+                upper_index = upper_index > (tablesize - 1) ? (tablesize - 1) : upper_index;
                 float delta = position - static_cast<float>(lower_index);
                 float interpolated_value = linear_interpolation.operator()(frameSamples->at(lower_index), frameSamples->at(upper_index), delta);
                 float y = (interpolated_value * yScaling * -1.f) + yOffset;
@@ -343,12 +612,13 @@ public:
             float origin_y = (morphedWaveform->at(0) * yScaling * -1.f) + morphFrameYOffset;
             float position = 0.f;
             float width = t.width() - margin;
-            float frac = static_cast<float>(internalTablesize) / width;
+            const int tablesize = static_cast<int>(morphedWaveform->size());
+            float frac = static_cast<float>(tablesize) / width;
             lib::interpolator::linear<> linear_interpolation;
             for (int i = 0; i < width; i++) {
                 int lower_index = floor(position);
                 int upper_index = ceil(position);
-                upper_index = upper_index > (internalTablesize - 1) ? (internalTablesize - 1) : upper_index;
+                upper_index = upper_index > (tablesize - 1) ? (tablesize - 1) : upper_index;
                 float delta = position - static_cast<float>(lower_index);
                 float interpolated_value = linear_interpolation.operator()(morphedWaveform->at(lower_index), morphedWaveform->at(upper_index), delta);
                 float y = (interpolated_value * yScaling * -1.f) + morphFrameYOffset;
@@ -372,7 +642,21 @@ public:
     ///==============
     void operator()(audio_bundle input, audio_bundle output)
     {
-        stackedFrames.process(output);
+#ifdef BFA_STACKED_TABLES_MC
+        //One pass over the shared tables for all channels
+        std::array<const sample*, Butterfly::AudioProcessor::maxChannels> frequencySignals{};
+        const int numFrequencySignals = message_in.has_signal_connection() ? std::min<int>(input.channel_count(), frequencySignals.size()) : 0;
+        for (int c = 0; c < numFrequencySignals; ++c) {
+            frequencySignals[c] = input.samples(c);
+        }
+        stackedFrames.processChannels(output, frequencySignals.data(), numFrequencySignals);
+#else
+        Butterfly::SignalInputs signals;
+        signals.morph = morph_in.has_signal_connection() ? input.samples(1) : nullptr;
+        signals.frequency = freq_in.has_signal_connection() ? input.samples(2) : nullptr;
+        signals.sync = sync_in.has_signal_connection() ? input.samples(3) : nullptr;
+        stackedFrames.process(output, signals);
+#endif
     }
 };
 
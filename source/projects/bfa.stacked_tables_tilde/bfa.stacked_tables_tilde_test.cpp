@@ -0,0 +1,1290 @@
+/// @file
+/// @ingroup     minexamples
+/// @copyright    Copyright 2018 The Min-DevKit Authors. All rights reserved.
+/// @license    Use of this source code is governed by the MIT License found in the License.md file.
+
+#include <chrono>
+#include <thread>
+#include "c74_min_unittest.h"
+#include "bfa.stacked_tables_tilde.cpp"
+
+
+// One sine table per band, band i may be played back up to maxPlaybackFrequencies[i]
+std::shared_ptr<Butterfly::FrameTables> makeSineTables(int size, std::vector<float> maxPlaybackFrequencies, int harmonic = 1) {
+	const std::vector<int> bandSizes(maxPlaybackFrequencies.size(), size);
+	auto tables = std::make_shared<Butterfly::FrameTables>(bandSizes);
+	for (size_t band = 0; band < tables->numBands(); ++band) {
+		float* data = tables->writableData(band);
+		for (int i = 0; i <= size; ++i) {
+			data[i] = static_cast<float>(std::sin(2. * M_PI * harmonic * i / size));
+		}
+		tables->setMaxPlaybackFrequency(band, maxPlaybackFrequencies[band]);
+	}
+	return tables;
+}
+
+// Number of samples the gain of AudioProcessor (a default RampedValue) takes to reach a new target
+int gainRampSteps() {
+	Butterfly::RampedValue<double> probe{ 0. };
+	probe.set(1.);
+	int steps = 0;
+	while (probe() != probe.getTarget() && steps < 1 << 20) {
+		++probe;
+		++steps;
+	}
+	return std::max(steps, 1);
+}
+
+
+TEST_CASE("Interpolation and crossfade kernel") {
+	const int size = 256;
+	const auto tablesA = makeSineTables(size, { 24000.f }, 1);
+	const auto tablesB = makeSineTables(size, { 24000.f }, 3);
+	const auto& tableA = tablesA->band(0);
+	const auto& tableB = tablesB->band(0);
+
+	// odd length to cover vector and scalar paths
+	const int n = 37;
+	std::vector<float> phases(n), morph(n), out(n);
+	for (int i = 0; i < n; ++i) {
+		phases[i] = static_cast<float>(i) / n;
+		morph[i] = static_cast<float>(n - i) / n;
+	}
+	Butterfly::interpolateAndCrossfade(tableA.data, tableB.data, size, phases.data(), morph.data(), out.data(), n);
+
+	for (int i = 0; i < n; ++i) {
+		const float pos = phases[i] * size;
+		const int i0 = static_cast<int>(pos);
+		const float frac = pos - i0;
+		const float a = tableA.data[i0] + frac * (tableA.data[i0 + 1] - tableA.data[i0]);
+		const float b = tableB.data[i0] + frac * (tableB.data[i0 + 1] - tableB.data[i0]);
+		REQUIRE(out[i] == Approx(a + morph[i] * (b - a)).margin(1e-6));
+	}
+
+	// per-frame gain and polarity
+	std::vector<float> scaled(n);
+	Butterfly::interpolateAndCrossfade(tableA.data, tableB.data, size, phases.data(), morph.data(), scaled.data(), n, 0.5f, -1.f);
+	std::vector<float> onlyA(n), onlyB(n);
+	const std::vector<float> zeros(n), ones(n, 1.f);
+	Butterfly::interpolateAndCrossfade(tableA.data, tableB.data, size, phases.data(), zeros.data(), onlyA.data(), n);
+	Butterfly::interpolateAndCrossfade(tableA.data, tableB.data, size, phases.data(), ones.data(), onlyB.data(), n);
+	for (int i = 0; i < n; ++i) {
+		REQUIRE(scaled[i] == Approx(0.5f * onlyA[i] + morph[i] * (-onlyB[i] - 0.5f * onlyA[i])).margin(1e-6));
+	}
+}
+
+
+TEST_CASE("Frame tables layout") {
+	const auto tables = makeSineTables(100, { 100.f, 1000.f, 10000.f });
+	for (const auto& band : tables->bands()) {
+		REQUIRE(reinterpret_cast<uintptr_t>(band.data) % Butterfly::FrameTables::alignment == 0);
+		REQUIRE(band.data[band.size] == Approx(band.data[0]).margin(1e-6));
+	}
+
+	// copies own their samples
+	Butterfly::FrameTables copy{ *tables };
+	copy.writableData(2)[25] = 2.f;
+	REQUIRE(copy.band(2).data != tables->band(2).data);
+	REQUIRE(copy.band(2).maxPlaybackFrequency == 10000.f);
+	REQUIRE(tables->band(2).data[25] == Approx(1.f));
+}
+
+
+TEST_CASE("Mip level sizes") {
+	// bands up to 1, 10, 100 and more than 128 harmonics
+	REQUIRE(Butterfly::mipTablesize(2048, 24000.f, 24000.f) == Butterfly::minMipTablesize);
+	REQUIRE(Butterfly::mipTablesize(2048, 24000.f, 2400.f) == 256);
+	REQUIRE(Butterfly::mipTablesize(2048, 24000.f, 240.f) == 2048);
+	REQUIRE(Butterfly::mipTablesize(2048, 24000.f, 40.f) == 2048);
+
+	// decimated bands keep every n-th sample
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * i / 2048.));
+	}
+	const Butterfly::Wavetable<float> wavetable{ samples, 24000.f };
+	const std::vector<int> bandSizes{ 2048, 64 };
+	Butterfly::FrameTables tables{ bandSizes };
+	tables.setBand(0, wavetable);
+	tables.setBand(1, wavetable);
+	REQUIRE(tables.band(1).data[16] == Approx(1.f));
+	REQUIRE(tables.band(1).data[64] == tables.band(1).data[0]);
+	REQUIRE(tables.band(1).maxPlaybackFrequency == 24000.f);
+}
+
+
+TEST_CASE("Spectral frames") {
+	// fundamental and 5th harmonic
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * i / 2048.) + 0.5 * std::sin(10. * M_PI * i / 2048.));
+	}
+
+	Butterfly::SpectralFrame spectrum{ samples };
+	std::vector<float> fundamental(64);
+	spectrum.synthesize(fundamental.data(), 64, 4);
+	for (size_t i = 0; i < fundamental.size(); ++i) {
+		REQUIRE(fundamental[i] == Approx(std::sin(2. * M_PI * i / 64.)).margin(1e-5));
+	}
+	std::vector<float> both(64);
+	spectrum.synthesize(both.data(), 64, 5);
+	REQUIRE(both[3] == Approx(samples[3 * 32]).margin(1e-5));
+
+	// bands of previous tables are copied, the rest synthesized
+	const auto splitFreqs = Butterfly::calculateSplitFreqs(2.f, 24000.f, 5.f);
+	const auto narrow = Butterfly::synthesizeMultitable(spectrum, splitFreqs, 48000.f, { 50, 60 });
+	const auto wide = Butterfly::synthesizeMultitable(spectrum, splitFreqs, 48000.f, { 40, 70 }, narrow.get());
+	const auto fresh = Butterfly::synthesizeMultitable(spectrum, splitFreqs, 48000.f, { 40, 70 });
+	REQUIRE(wide->numBands() == 31);
+	for (size_t i = 0; i < wide->numBands(); ++i) {
+		const auto& band = wide->band(i);
+		REQUIRE(band.size == fresh->band(i).size);
+		REQUIRE(band.maxPlaybackFrequency == fresh->band(i).maxPlaybackFrequency);
+		for (int k = 0; k <= band.size; ++k) {
+			REQUIRE(band.data[k] == Approx(fresh->band(i).data[k]).margin(1e-6));
+		}
+	}
+
+	// only the bands for the frequency range and set_freq are synthesized
+	Butterfly::StackedFrames stackedFrames{ 48000.f, 2048, 6000.f, 16 };
+	stackedFrames.setStorageMode(Butterfly::StorageMode::spectral);
+	stackedFrames.setFrequencyRange(4000.f, 8000.f);
+	stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+	const auto spectralSize = stackedFrames.getTablesSizeInBytes();
+	stackedFrames.setOscFreq(12000.);
+	REQUIRE(stackedFrames.getTablesSizeInBytes() > spectralSize);
+	stackedFrames.setStorageMode(Butterfly::StorageMode::tables);
+	REQUIRE(stackedFrames.getTablesSizeInBytes() > 4 * spectralSize);
+
+	// without a frequency range the bands follow set_freq and the held notes
+	Butterfly::StackedFrames following{ 48000.f, 2048, 440.f, 16 };
+	following.setStorageMode(Butterfly::StorageMode::spectral);
+	following.addFrame(Butterfly::createSpectralFrame(samples));
+	const auto bandsAt440 = following.getSpectralBands();
+	REQUIRE(bandsAt440.second - bandsAt440.first == 2);
+	following.playNote(93, 100.f);
+	REQUIRE(following.getSpectralBands().second > bandsAt440.second + 2);
+	following.playNote(93, 0.f);
+	REQUIRE(following.getSpectralBands() == bandsAt440);
+
+	// bands are synthesized in the background and published once they are collected
+	std::atomic<int> numReady{};
+	Butterfly::StackedFrames background{ 48000.f, 2048, 440.f, 16, [&] { ++numReady; } };
+	background.setStorageMode(Butterfly::StorageMode::spectral);
+	background.addFrame(Butterfly::createSpectralFrame(samples));
+	background.setOscFreq(3520.);
+	REQUIRE(background.getSpectralBands() == bandsAt440);
+	while (numReady < 1) {
+		std::this_thread::yield();
+	}
+	background.collectSpectralBands([](const std::string&) {});
+	REQUIRE(background.getSpectralBands().first > bandsAt440.second);
+
+	// moving back takes the cached bands without a job
+	background.setOscFreq(440.);
+	REQUIRE(background.getSpectralBands() == bandsAt440);
+	REQUIRE(numReady == 1);
+}
+
+
+TEST_CASE("Band cache") {
+	const std::vector<int> bandSizes{ 64, 32 };
+	auto makeTables = [&] { return std::make_shared<const Butterfly::FrameTables>(bandSizes); };
+	const auto tablesBytes = makeTables()->sizeInBytes();
+	Butterfly::BandCache cache{ 2 * tablesBytes };
+	auto inUse = makeTables();
+	cache.insert({ 1, 48000.f, { 0, 1 } }, inUse);
+	cache.insert({ 2, 48000.f, { 0, 1 } }, makeTables());
+	cache.insert({ 3, 48000.f, { 0, 1 } }, makeTables());
+	cache.insert({ 4, 48000.f, { 0, 1 } }, makeTables());
+	REQUIRE(cache.find({ 2, 48000.f, { 0, 1 } }) != nullptr);
+
+	// unused tables beyond the capacity are evicted least recently used first, tables in use are kept
+	cache.trim();
+	REQUIRE(cache.size() == 3);
+	REQUIRE(cache.unusedBytes() == 2 * tablesBytes);
+	REQUIRE(cache.find({ 1, 48000.f, { 0, 1 } }) == inUse);
+	REQUIRE(cache.find({ 3, 48000.f, { 0, 1 } }) == nullptr);
+	REQUIRE(cache.find({ 2, 44100.f, { 0, 1 } }) == nullptr);
+
+	inUse.reset();
+	cache.setCapacity(0);
+	REQUIRE(cache.size() == 0);
+}
+
+
+TEST_CASE("Internal table size") {
+	REQUIRE(Butterfly::isSupportedTablesize(256));
+	REQUIRE(!Butterfly::isSupportedTablesize(2000));
+
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * 3. * i / 2048.));
+	}
+	const auto resampled = Butterfly::resamplePeriod(samples, 256);
+	REQUIRE(resampled.size() == 256);
+	for (size_t i = 0; i < resampled.size(); ++i) {
+		REQUIRE(resampled[i] == Approx(samples[i * 8]).margin(1e-5));
+	}
+
+	// existing frames are resampled, frames of the old size are resampled when added
+	Butterfly::StackedFrames stackedFrames{ 48000.f, 2048, 440.f, 16 };
+	stackedFrames.setStorageMode(Butterfly::StorageMode::spectral);
+	stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+	stackedFrames.setInternalTablesize(512);
+	stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+	REQUIRE(stackedFrames.getInternalTablesize() == 512);
+	REQUIRE(stackedFrames.getFrame(0)->size() == 512);
+	REQUIRE(stackedFrames.getFrame(1)->size() == 512);
+	REQUIRE(stackedFrames.getFrame(1)->at(10) == Approx(samples[40]).margin(1e-5));
+}
+
+
+TEST_CASE("Memory budget") {
+	std::vector<float> samples(256);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * i / 256.));
+	}
+
+	// frames beyond the budget spill to spectral storage, spilled frames count against the budget
+	Butterfly::StackedFrames stackedFrames{ 48000.f, 256, 440.f, 256 };
+	stackedFrames.setStorageMode(Butterfly::StorageMode::tables);
+	const auto fullSize = [&] {
+		stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+		return stackedFrames.getTablesSizeInBytes();
+	}();
+	stackedFrames.setMemoryBudget(8 * fullSize);
+	for (int i = 0; i < 63; ++i) {
+		stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+	}
+	REQUIRE(stackedFrames.getNumFrames() == 64);
+	REQUIRE(stackedFrames.getTablesSizeInBytes() <= 8 * fullSize);
+	REQUIRE(!stackedFrames.exceedsMemoryBudget());
+
+	// wider bands spill more frames
+	const auto spilledSize = stackedFrames.getTablesSizeInBytes();
+	stackedFrames.setOscFreq(880.);
+	REQUIRE(stackedFrames.getTablesSizeInBytes() <= 8 * fullSize);
+	stackedFrames.setFrequencyRange(20.f, 20000.f);
+	REQUIRE(stackedFrames.exceedsMemoryBudget());
+	stackedFrames.setFrequencyRange(0.f, 0.f);
+	REQUIRE(stackedFrames.getTablesSizeInBytes() <= 8 * fullSize);
+	REQUIRE(spilledSize < 64 * fullSize / 2);
+
+	// more budget renders spilled frames fully again
+	stackedFrames.setMemoryBudget(64 * fullSize);
+	REQUIRE(stackedFrames.getTablesSizeInBytes() == 64 * fullSize);
+}
+
+
+TEST_CASE("Export") {
+	auto harmonic = [](int k, double pos) { return static_cast<float>(std::sin(2. * M_PI * k * pos)); };
+	std::vector<float> samples(256);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = harmonic(3, i / 256.);
+	}
+	Butterfly::StackedFrames stackedFrames{ 48000.f, 256, 440.f, 16 };
+	stackedFrames.setStorageMode(Butterfly::StorageMode::spectral);
+	stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+	stackedFrames.addFrame(Butterfly::createSpectralFrame(samples));
+	stackedFrames.flipPhase();
+
+	// the second frame is inverted
+	const int exportTablesize = 100;
+	std::vector<float> out(stackedFrames.getExportSize(exportTablesize));
+	REQUIRE(out.size() == 200);
+	stackedFrames.exportFrames(out.data(), exportTablesize);
+	for (int i = 0; i < exportTablesize; ++i) {
+		REQUIRE(out[i] == Approx(harmonic(3, i / 100.)).margin(1e-3));
+		REQUIRE(out[exportTablesize + i] == Approx(-out[i]));
+	}
+}
+
+
+TEST_CASE("Periodic resampler") {
+	auto harmonic = [](int k, double pos) { return static_cast<float>(std::sin(2. * M_PI * k * pos)); };
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = harmonic(1, i / 2048.) + 0.5f * harmonic(7, i / 2048.) + 0.25f * harmonic(200, i / 2048.);
+	}
+
+	SECTION("arbitrary ratios keep the passband") {
+		for (const int size : { 3001, 4096, 1000 }) {
+			std::vector<float> out(size);
+			Butterfly::PeriodicResampler{ 2048, size, Butterfly::ResamplerQuality::high }.process(samples.data(), out.data(), 2.f);
+			for (int i = 0; i < size; i += 7) {
+				const double pos = static_cast<double>(i) / size;
+				REQUIRE(out[i] == Approx(2.f * (harmonic(1, pos) + 0.5f * harmonic(7, pos) + 0.25f * harmonic(200, pos))).margin(1e-3));
+			}
+		}
+	}
+
+	SECTION("harmonics above the output Nyquist are removed") {
+		std::vector<float> out(256);
+		Butterfly::PeriodicResampler{ 2048, 256, Butterfly::ResamplerQuality::normal }.process(samples.data(), out.data());
+		for (int i = 0; i < 256; ++i) {
+			REQUIRE(out[i] == Approx(harmonic(1, i / 256.) + 0.5f * harmonic(7, i / 256.)).margin(1e-3));
+		}
+	}
+}
+
+
+TEST_CASE("Frame cache") {
+	Butterfly::FrameCache cache;
+	const std::vector<float> samples(64, 0.5f), splitFreqs{ 1000.f, 24000.f };
+	int numBuilds{};
+	auto build = [&] {
+		++numBuilds;
+		return makeSineTables(64, splitFreqs);
+	};
+
+	auto first = cache.getOrBuild({ samples, 48000.f, splitFreqs }, build);
+	auto second = cache.getOrBuild({ samples, 48000.f, splitFreqs }, build);
+	REQUIRE(numBuilds == 1);
+	REQUIRE(first == second);
+
+	// any part of the key differs
+	auto otherRate = cache.getOrBuild({ samples, 44100.f, splitFreqs }, build);
+	REQUIRE(numBuilds == 2);
+	REQUIRE(cache.size() == 2);
+
+	// entries don't keep their tables alive
+	first.reset();
+	second.reset();
+	REQUIRE(cache.size() == 1);
+	cache.getOrBuild({ samples, 48000.f, splitFreqs }, build);
+	REQUIRE(numBuilds == 3);
+}
+
+
+TEST_CASE("Shared thread pool lifetime") {
+	const auto& state = Butterfly::detail::sharedThreadPoolState();
+	{
+		Butterfly::ThreadPoolUser first;
+		std::atomic<int> sum{};
+		Butterfly::sharedThreadPool().parallelFor(10, [&](size_t i) { sum += static_cast<int>(i); });
+		REQUIRE(sum == 45);
+		{
+			Butterfly::ThreadPoolUser second;
+		}
+		REQUIRE(state.pool != nullptr);		// still in use by the first one
+	}
+	REQUIRE(state.pool == nullptr);			// joined with the last user, not at unload
+}
+
+
+TEST_CASE("Async frame builder") {
+	std::atomic<int> numReady{};
+	Butterfly::AsyncFrameBuilder builder{ [&] { ++numReady; } };
+	builder.submit([] { Butterfly::Frame frame; frame.peak = 1.f; return frame; });
+	builder.submit([]() -> Butterfly::Frame { throw std::runtime_error("out of memory"); });
+	builder.submit([] { Butterfly::Frame frame; frame.peak = 3.f; return frame; });
+	while (numReady < 3) {
+		std::this_thread::yield();
+	}
+
+	// failures are reported in submission order, not dropped
+	std::vector<float> committed;
+	std::vector<std::string> errors;
+	REQUIRE(builder.collect([&](Butterfly::Frame&& frame) { committed.push_back(frame.peak); },
+		[&](const std::string& error) { errors.push_back(error); }) == 2);
+	REQUIRE(committed == std::vector<float>({ 1.f, 3.f }));
+	REQUIRE(errors == std::vector<std::string>({ "out of memory" }));
+	REQUIRE(builder.numPending() == 0);
+}
+
+
+TEST_CASE("Block oscillator") {
+	const double sampleRate = 48000.;
+	const auto first = makeSineTables(2048, { 100.f, 24000.f }, 1);
+	const auto second = makeSineTables(2048, { 100.f, 24000.f }, 2);
+	std::vector<const Butterfly::FrameTables*> waveforms{ first.get(), second.get() };
+
+	Butterfly::MorphingBlockOscillator osc;
+	osc.setSampleRate(sampleRate);
+	osc.setFrequency(480.);
+	const std::vector<float> gains{ 1.f, -0.5f };
+	osc.setWaveforms(waveforms, gains);
+
+	// 100 samples per period, not a multiple of the block size
+	std::vector<float> out(250), right(250);
+	osc.process(out.data(), right.data(), static_cast<int>(out.size()));
+	for (size_t i = 0; i < out.size(); ++i) {
+		REQUIRE(out[i] == Approx(std::sin(2. * M_PI * i / 100.)).margin(1e-4));
+		REQUIRE(right[i] == out[i]);
+	}
+
+	// morphing to the last, inverted and attenuated frame is ramped over a single block
+	osc.setNormalizedMorphingParam(1.);
+	osc.process(out.data(), right.data(), Butterfly::MorphingBlockOscillator::blockSize);
+	osc.process(out.data(), right.data(), static_cast<int>(out.size()));
+	const auto offset = 250 + Butterfly::MorphingBlockOscillator::blockSize;
+	for (size_t i = 0; i < out.size(); ++i) {
+		REQUIRE(out[i] == Approx(-0.5 * std::sin(4. * M_PI * (offset + i) / 100.)).margin(1e-4));
+	}
+}
+
+
+TEST_CASE("State handoff") {
+	Butterfly::StateHandoff<int> handoff;
+	REQUIRE(handoff.acquire() == nullptr);
+
+	auto first = std::make_shared<int>(1);
+	handoff.publish(first);
+	REQUIRE(*handoff.acquire() == 1);
+
+	// the reader may still use the first state until it acquires again
+	handoff.publish(std::make_shared<int>(2));
+	REQUIRE(handoff.numPinned() == 2);
+	REQUIRE(*handoff.acquire() == 2);
+	handoff.reclaim();
+	REQUIRE(handoff.numPinned() == 1);
+	REQUIRE(first.use_count() == 1);
+
+	// while the reader is idle only the state it holds stays pinned, the ones it never saw are freed right away
+	auto held = handoff.acquire();
+	std::weak_ptr<int> skipped;
+	for (int i = 3; i < 10; ++i) {
+		auto state = std::make_shared<int>(i);
+		if (i == 5) { skipped = state; }
+		handoff.publish(std::move(state));
+	}
+	REQUIRE(handoff.numPinned() == 2);
+	REQUIRE(skipped.expired());
+	REQUIRE(*held == 2);
+	REQUIRE(*handoff.acquire() == 9);
+	handoff.reclaim();
+	REQUIRE(handoff.numPinned() == 1);
+}
+
+
+// State with numFrames entries, sharing one table
+std::shared_ptr<Butterfly::AudioProcessor::State> makeState(int numFrames) {
+	static const auto tables = makeSineTables(64, { 24000.f });
+	auto state = std::make_shared<Butterfly::AudioProcessor::State>();
+	for (int i = 0; i < numFrames; ++i) {
+		state->add(tables, 1.f);
+	}
+	return state;
+}
+
+
+TEST_CASE("Timestamped events") {
+	Butterfly::AudioProcessor processor;
+	processor.init(440., 48000.);
+	Butterfly::AudioProcessor::State state;
+	state.add(makeSineTables(256, { 24000.f }), 1.f);
+	processor.changeState(std::move(state));
+
+	// the gain ramps from the sample of its event on and has reached the target rampSteps samples later, the blocks
+	// are long enough for every ramp to finish within them
+	const int rampSteps = gainRampSteps();
+	const int length = 2 * (rampSteps + 128);
+	std::vector<double> output(length);
+	double* channels[]{ output.data() };
+	c74::min::audio_bundle buffer{ channels, 1, output.size() };
+	auto reference = [](int i) { return std::sin(2. * M_PI * 440. * i / 48000.); };
+	auto requireRampStart = [&](int i, int time, double from, double to) {
+		const double gain = output[i] / reference(time);
+		REQUIRE(gain <= std::max(from, to) + 1e-3);
+		REQUIRE(gain >= std::min(from, to) - 1e-3);
+	};
+
+	// one event in this block, one in the next, one in the past
+	const int lastEvent = rampSteps + 150;
+	processor.addParamEvent({ Butterfly::ParameterType::gain, 0., static_cast<int64_t>(length + lastEvent) });
+	processor.addParamEvent({ Butterfly::ParameterType::gain, 0.5, 100 });
+	processor.process(buffer);
+	REQUIRE(processor.getSampleTime() == length);
+	REQUIRE(output[99] == Approx(reference(99)).margin(1e-3));
+	requireRampStart(100, 100, 1., 0.5);
+	REQUIRE(output[100 + rampSteps] == Approx(0.5 * reference(100 + rampSteps)).margin(1e-3));
+	REQUIRE(output[length - 1] == Approx(0.5 * reference(length - 1)).margin(1e-3));
+
+	processor.addParamEvent({ Butterfly::ParameterType::gain, 1., 0 });
+	processor.process(buffer);
+	requireRampStart(1, length + 1, 0.5, 1.);
+	REQUIRE(output[rampSteps] == Approx(reference(length + rampSteps)).margin(1e-3));
+	REQUIRE(output[lastEvent - 1] == Approx(reference(length + lastEvent - 1)).margin(1e-3));
+	requireRampStart(lastEvent + 1, length + lastEvent + 1, 1., 0.);
+	REQUIRE(output[lastEvent + rampSteps] == Approx(0.).margin(1e-6));
+	REQUIRE(output[length - 1] == Approx(0.).margin(1e-6));
+}
+
+
+TEST_CASE("Parameter store") {
+	Butterfly::ParameterStore<4> store;
+	std::vector<std::pair<size_t, double>> consumed;
+	auto collect = [&](size_t slot, double value) { consumed.push_back({ slot, value }); };
+
+	// a fast sweep coalesces to its last value
+	for (int i = 0; i <= 1000; ++i) {
+		store.set(2, i / 1000.);
+	}
+	store.set(0, 0.5);
+	store.consume(collect);
+	const std::vector<std::pair<size_t, double>> expected{ { 0, 0.5 }, { 2, 1. } };
+	REQUIRE(consumed == expected);
+
+	consumed.clear();
+	store.consume(collect);
+	REQUIRE(consumed.empty());
+
+	// immediate events go through the store, whatever their number
+	Butterfly::AudioProcessor processor;
+	processor.init(440., 48000.);
+	Butterfly::AudioProcessor::State state;
+	state.add(makeSineTables(256, { 24000.f }), 1.f);
+	processor.changeState(std::move(state));
+	for (int i = 0; i < 1000; ++i) {
+		processor.addParamEvent({ Butterfly::ParameterType::gain, i % 2 == 0 ? 0. : 0.25 });
+	}
+	std::vector<double> output(64);
+	double* channels[]{ output.data() };
+	c74::min::audio_bundle buffer{ channels, 1, output.size() };
+
+	// only the last value arrives, the gain has ramped there once the ramp is over
+	const int numBlocks = gainRampSteps() / 64 + 1;
+	for (int i = 0; i <= numBlocks; ++i) {
+		processor.process(buffer);
+	}
+	REQUIRE(output[16] == Approx(0.25 * std::sin(2. * M_PI * 440. * (64 * numBlocks + 16) / 48000.)).margin(1e-3));
+}
+
+
+TEST_CASE("Morph signal") {
+	Butterfly::AudioProcessor processor;
+	processor.init(440., 48000.);
+	Butterfly::AudioProcessor::State state;
+	const auto tables = makeSineTables(256, { 24000.f });
+	state.add(tables, 1.f);
+	state.add(tables, -1.f);
+	state.add(tables, 0.5f);
+	processor.changeState(std::move(state));
+
+	// a sweep through all frames, out of range positions are clamped
+	std::vector<double> output(200), morph(200);
+	for (size_t i = 0; i < morph.size(); ++i) {
+		morph[i] = -0.5 + 2. * static_cast<double>(i) / morph.size();
+	}
+	double* channels[]{ output.data() };
+	c74::min::audio_bundle buffer{ channels, 1, output.size() };
+	processor.process(buffer, { morph.data() });
+
+	auto reference = [](int i) { return std::sin(2. * M_PI * 440. * i / 48000.); };
+	auto frameGain = [](double pos) {
+		const double weight = std::clamp(pos, 0., 1.) * 2.;
+		return weight < 1. ? 1. - 2. * weight : -1. + 1.5 * (weight - 1.);
+	};
+	for (int i = 0; i < 200; i += 3) {
+		REQUIRE(output[i] == Approx(frameGain(morph[i]) * reference(i)).margin(1e-3));
+	}
+
+	// NaN and infinity play the first frame, also after the signal ended on one
+	std::fill(morph.begin(), morph.end(), 0.75);
+	morph[10] = std::numeric_limits<double>::quiet_NaN();
+	morph[101] = std::numeric_limits<double>::infinity();
+	morph[199] = std::numeric_limits<double>::quiet_NaN();
+	processor.process(buffer, { morph.data() });
+	REQUIRE(output[10] == Approx(reference(210)).margin(1e-3));
+	REQUIRE(output[101] == Approx(reference(301)).margin(1e-3));
+	REQUIRE(output[11] == Approx(frameGain(0.75) * reference(211)).margin(1e-3));
+	processor.process(buffer);
+	for (const double x : output) {
+		REQUIRE(std::isfinite(x));
+	}
+}
+
+
+TEST_CASE("Frequency signal") {
+	std::vector<float> phases(61);
+	SECTION("phase accumulation, backwards through zero") {
+		std::vector<double> frequencies(phases.size());
+		for (size_t i = 0; i < frequencies.size(); ++i) {
+			frequencies[i] = 3000. - 200. * static_cast<double>(i);
+		}
+		double phase = 0.25;
+		const float maxFrequency = Butterfly::accumulatePhases(frequencies.data(), 1.f / 48000.f, phase, phases.data(), static_cast<int>(phases.size()));
+		REQUIRE(maxFrequency == Approx(9000.f));
+
+		double expected = 0.25;
+		for (size_t i = 0; i < phases.size(); ++i) {
+			REQUIRE(phases[i] == Approx(expected - std::floor(expected)).margin(1e-5));
+			expected += frequencies[i] / 48000.;
+		}
+		REQUIRE(phase == Approx(expected - std::floor(expected)).margin(1e-5));
+	}
+
+	SECTION("the band follows the highest frequency of the block") {
+		Butterfly::MorphingBlockOscillator osc;
+		osc.setSampleRate(48000.);
+		osc.setFrequency(100.);
+		const std::vector<float> gains{ 1.f };
+		auto tables = std::make_shared<Butterfly::FrameTables>(std::vector<int>{ 256, 256 });
+		for (size_t band = 0; band < 2; ++band) {
+			std::fill_n(tables->writableData(band), 257, band == 0 ? 1.f : -1.f);
+			tables->setMaxPlaybackFrequency(band, band == 0 ? 1000.f : 24000.f);
+		}
+		const std::vector<const Butterfly::FrameTables*> constTables{ tables.get() };
+		osc.setWaveforms(constTables, gains);
+
+		std::vector<float> out(128), right(128);
+		std::vector<double> frequencies(128, 500.);
+		frequencies[100] = 2000.;
+		osc.process(out.data(), right.data(), 128, nullptr, frequencies.data());
+		REQUIRE(out[10] == 1.f);
+		REQUIRE(out[70] == -1.f);
+	}
+
+	SECTION("NaN and infinity play as 0 Hz and leave the phase finite") {
+		std::vector<double> frequencies(phases.size(), 1000.);
+		frequencies[10] = std::numeric_limits<double>::quiet_NaN();
+		frequencies[20] = std::numeric_limits<double>::infinity();
+		frequencies[50] = -std::numeric_limits<double>::infinity();
+		double phase = 0.25;
+		const float maxFrequency = Butterfly::accumulatePhases(frequencies.data(), 1.f / 48000.f, phase, phases.data(), static_cast<int>(phases.size()));
+		REQUIRE(maxFrequency == 1000.f);
+		REQUIRE(std::isfinite(phase));
+		REQUIRE(phases[11] == Approx(phases[10]));
+		REQUIRE(phases[21] == Approx(phases[20]));
+
+		Butterfly::MorphingBlockOscillator osc;
+		osc.setSampleRate(48000.);
+		osc.setFrequency(100.);
+		const std::vector<float> gains{ 1.f };
+		auto tables = std::make_shared<Butterfly::FrameTables>(std::vector<int>{ 256 });
+		for (int i = 0; i <= 256; ++i) {
+			tables->writableData(0)[i] = static_cast<float>(i % 256) / 256.f;
+		}
+		tables->setMaxPlaybackFrequency(0, 24000.f);
+		const std::vector<const Butterfly::FrameTables*> constTables{ tables.get() };
+		osc.setWaveforms(constTables, gains);
+
+		std::vector<float> out(128), right(128);
+		std::vector<double> signal(128, 500.);
+		signal[10] = std::numeric_limits<double>::quiet_NaN();
+		osc.process(out.data(), right.data(), 128, nullptr, signal.data());
+		osc.process(out.data(), right.data(), 128);
+		for (const float x : out) {
+			REQUIRE(std::isfinite(x));
+		}
+	}
+}
+
+
+TEST_CASE("Voice bank") {
+	Butterfly::VoiceBank voices;
+	voices.setNumVoices(2);
+	voices.noteOn(60, 127.f);
+	voices.noteOn(64, 64.f);
+	REQUIRE(voices.numActive() == 2);
+
+	// steals the oldest released voice before the oldest one
+	voices.noteOff(64);
+	voices.noteOn(67, 100.f);
+	REQUIRE(voices.numActive() == 2);
+	REQUIRE(voices.notes[0] == 60);
+	REQUIRE(voices.notes[1] == 67);
+	voices.noteOn(72, 100.f);
+	REQUIRE(voices.notes[0] == 72);
+	REQUIRE(voices.frequencies[0] == Approx(Butterfly::VoiceBank::noteToFrequency(72)));
+
+	// released voices are freed after fading out for one block
+	voices.noteOn(67, 0.f);
+	voices.noteOff(72);
+	voices.prepareBlock(64, 1.f / 48000.f);
+	voices.finishBlock();
+	REQUIRE(voices.numActive() == 0);
+
+	// a note ramps in over levelRampSamples, also if the block is split into segments of one sample
+	voices.noteOn(60, 127.f);
+	const int v = voices.notes[0] == 60 ? 0 : 1;
+	for (int i = 0; i < Butterfly::VoiceBank::levelRampSamples; ++i) {
+		voices.prepareBlock(1, 1.f / 48000.f);
+		REQUIRE(voices.levelSteps[v] == Approx(1.f / Butterfly::VoiceBank::levelRampSamples));
+		voices.levels[v] += voices.levelSteps[v];
+		voices.finishBlock();
+	}
+	REQUIRE(voices.levels[v] == 1.f);
+	voices.prepareBlock(1, 1.f / 48000.f);
+	REQUIRE(voices.levelSteps[v] == 0.f);
+}
+
+
+TEST_CASE("Polyphonic rendering") {
+	Butterfly::AudioProcessor processor;
+	processor.init(100., 48000.);
+	Butterfly::AudioProcessor::State state;
+	state.add(makeSineTables(1024, { 2000.f, 24000.f }), 1.f);
+	processor.changeState(std::move(state));
+
+	// more notes than SIMD lanes in one band, one in the other band
+	const std::vector<int> notes{ 48, 52, 55, 60, 64, 96 };
+	processor.addParamEvent({ Butterfly::ParameterType::numVoices, 8. });
+	for (const auto note : notes) {
+		processor.addParamEvent({ Butterfly::ParameterType::note, static_cast<double>(note), Butterfly::Event::immediate, 127.f });
+	}
+	std::vector<double> output(256);
+	double* channels[]{ output.data() };
+	c74::min::audio_bundle buffer{ channels, 1, output.size() };
+	processor.process(buffer);
+	processor.process(buffer);
+
+	// the first block fades in, the second one plays at full level
+	for (int i = 0; i < 256; i += 5) {
+		double expected{};
+		for (const auto note : notes) {
+			const float increment = Butterfly::VoiceBank::noteToFrequency(note) / 48000.f;
+			expected += std::sin(2. * M_PI * std::fmod(static_cast<double>(increment) * (256 + i), 1.));
+		}
+		REQUIRE(output[i] == Approx(expected).margin(2e-3));
+	}
+}
+
+
+TEST_CASE("Voices with their own morph position") {
+	const auto tables = makeSineTables(1024, { 24000.f });
+	const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get(), tables.get(), tables.get() };
+	const std::vector<float> gains{ 1.f, -1.f, 0.5f };
+	Butterfly::MorphingBlockOscillator osc;
+	osc.setSampleRate(48000.);
+	osc.setWaveforms(waveforms, gains);
+
+	// the oscillator stays on the first frame, one voice plays halfway between the second and the third one
+	Butterfly::VoiceBank voices;
+	voices.setNumVoices(4);
+	voices.noteOn(60, 127.f);
+	voices.noteOn(72, 127.f, 0.75f);
+	voices.noteOn(67, 127.f, 0.f);
+	std::vector<float> left(64), right(64);
+	osc.processVoices(left.data(), right.data(), 64, voices);
+	osc.processVoices(left.data(), right.data(), 64, voices);
+	for (int i = 0; i < 64; ++i) {
+		auto voice = [i](int note) {
+			const float increment = Butterfly::VoiceBank::noteToFrequency(note) / 48000.f;
+			return std::sin(2. * M_PI * std::fmod(static_cast<double>(increment) * (64 + i), 1.));
+		};
+		REQUIRE(left[i] == Approx(voice(60) - 0.25 * voice(72) + voice(67)).margin(2e-3));
+	}
+}
+
+TEST_CASE("Polyphonic rendering across bands") {
+	// the band layout of a real frame, bands are 2 semitones apart and shorter towards the top
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * i / 2048.));
+	}
+	const Butterfly::SpectralFrame spectrum{ samples };
+	const auto splitFreqs = Butterfly::calculateSplitFreqs(2.f, 24000.f, 5.f);
+	const auto tables = Butterfly::synthesizeMultitable(spectrum, splitFreqs, 48000.f, { 0, splitFreqs.size() - 1 });
+	const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get(), tables.get() };
+	const std::vector<float> gains{ 1.f, 1.f };
+	Butterfly::MorphingBlockOscillator osc;
+	osc.setSampleRate(48000.);
+	osc.setWaveforms(waveforms, gains);
+
+	// a chord over three octaves, every voice in a band of its own
+	const std::vector<int> notes{ 36, 48, 55, 60, 64, 67, 72, 79, 84 };
+	Butterfly::VoiceBank voices;
+	voices.setNumVoices(16);
+	for (const auto note : notes) {
+		voices.noteOn(note, 127.f);
+	}
+	std::vector<float> left(64), right(64);
+	osc.processVoices(left.data(), right.data(), 64, voices);
+	osc.processVoices(left.data(), right.data(), 64, voices);
+
+	for (int i = 0; i < 64; ++i) {
+		double expected{};
+		for (const auto note : notes) {
+			const float increment = Butterfly::VoiceBank::noteToFrequency(note) / 48000.f;
+			expected += std::sin(2. * M_PI * std::fmod(static_cast<double>(increment) * (64 + i), 1.));
+		}
+		REQUIRE(left[i] == Approx(expected).margin(2e-3));
+		REQUIRE(right[i] == left[i]);
+	}
+}
+
+
+TEST_CASE("Unison") {
+	const auto tables = makeSineTables(1024, { 24000.f });
+	const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get() };
+	const std::vector<float> gains{ 1.f };
+	Butterfly::MorphingBlockOscillator osc;
+	osc.setSampleRate(48000.);
+	osc.setFrequency(300.);
+	osc.setWaveforms(waveforms, gains);
+	std::vector<float> left(200), right(200);
+
+	SECTION("two copies, detuned and panned hard left and right") {
+		osc.setUnison(2, 20.f, 1.f);
+		osc.process(left.data(), right.data(), 200);
+		const double incrementLeft = 300. * std::exp2(-20. / 1200.) / 48000.;
+		const double incrementRight = 300. * std::exp2(20. / 1200.) / 48000.;
+		for (int i = 0; i < 200; i += 3) {
+			REQUIRE(left[i] == Approx(std::sin(2. * M_PI * incrementLeft * i)).margin(1e-3));
+			REQUIRE(right[i] == Approx(std::sin(2. * M_PI * (0.618034 + incrementRight * i))).margin(1e-3));
+		}
+	}
+
+	SECTION("more copies than SIMD lanes, without width") {
+		osc.setUnison(13, 30.f, 0.f);
+		osc.process(left.data(), right.data(), 200);
+		double expected{};
+		for (int k = 0; k < 13; ++k) {
+			const double increment = 300. * std::exp2((k / 6. - 1.) * 30. / 1200.) / 48000.;
+			expected += std::sin(2. * M_PI * (std::fmod(k * 0.618034, 1.) + increment * 199)) / std::sqrt(13.);
+		}
+		REQUIRE(left[199] == Approx(expected).margin(2e-3));
+		REQUIRE(right[199] == Approx(left[199]));
+	}
+
+	SECTION("a frequency signal sweeps every copy sample by sample") {
+		Butterfly::MorphingBlockOscillator sweeping;
+		sweeping.setSampleRate(48000.);
+		sweeping.setWaveforms(waveforms, gains);
+		sweeping.setUnison(2, 20.f, 1.f);
+		std::vector<double> frequencies(200);
+		for (int i = 0; i < 200; ++i) {
+			frequencies[i] = 200. + 4. * i;
+		}
+		sweeping.process(left.data(), right.data(), 200, nullptr, frequencies.data());
+		const double ratioLeft = std::exp2(-20. / 1200.), ratioRight = std::exp2(20. / 1200.);
+		double phaseLeft{}, phaseRight{ 0.618034 };
+		for (int i = 0; i < 200; ++i) {
+			REQUIRE(left[i] == Approx(std::sin(2. * M_PI * phaseLeft)).margin(1e-3));
+			REQUIRE(right[i] == Approx(std::sin(2. * M_PI * phaseRight)).margin(1e-3));
+			phaseLeft += frequencies[i] * ratioLeft / 48000.;
+			phaseRight += frequencies[i] * ratioRight / 48000.;
+		}
+	}
+}
+
+
+TEST_CASE("Multichannel rendering") {
+	Butterfly::AudioProcessor processor;
+	processor.init(300., 48000.);
+	processor.enableChannels();
+	Butterfly::AudioProcessor::State state;
+	const auto tables = makeSineTables(1024, { 24000.f });
+	state.add(tables, 1.f);
+	state.add(tables, -1.f);
+	processor.changeState(std::move(state));
+
+	// channel 1 an octave up and morphed to the inverted frame, channel 2 repeats its offsets
+	processor.changeChannelLayout({ 3, { 0.f, 1200.f }, { 0.f, 1.f } });
+	std::vector<std::vector<double>> outputs(4, std::vector<double>(150, 1.));
+	double* channels[]{ outputs[0].data(), outputs[1].data(), outputs[2].data(), outputs[3].data() };
+	c74::min::audio_bundle buffer{ channels, 4, 150 };
+	processor.processChannels(buffer);
+
+	for (int i = 0; i < 150; i += 7) {
+		REQUIRE(outputs[0][i] == Approx(std::sin(2. * M_PI * 300. * i / 48000.)).margin(1e-3));
+		if (i >= Butterfly::MorphingBlockOscillator::blockSize) { // after the morph ramp
+			REQUIRE(outputs[1][i] == Approx(-std::sin(2. * M_PI * 600. * i / 48000.)).margin(1e-3));
+		}
+		REQUIRE(outputs[2][i] == outputs[1][i]);
+		REQUIRE(outputs[3][i] == 0.);
+	}
+
+	// frequency signals per channel, wrapping around
+	std::vector<double> frequency(150, 1200.);
+	const double* frequencySignals[]{ frequency.data() };
+	processor.processChannels(buffer, frequencySignals, 1);
+	for (int i = 0; i < 150; i += 7) {
+		REQUIRE(outputs[0][i] == Approx(std::sin(2. * M_PI * (300. * 150. + 1200. * i) / 48000.)).margin(1e-3));
+		REQUIRE(outputs[2][i] == Approx(-std::sin(2. * M_PI * (600. * 150. + 1200. * i) / 48000.)).margin(1e-3));
+	}
+}
+
+
+TEST_CASE("Morph glide") {
+	// share of each frame per sample
+	auto glideMix = [](Butterfly::MorphGlide& glide, int n) {
+		std::vector<float> weights(n);
+		std::vector<std::array<float, 5>> mix(n);
+		glide.process(n, weights.data(), [&](int firstTable, int secondTable, int begin, int end) {
+			for (int i = begin; i < end; ++i) {
+				mix[i][firstTable] += 1.f - weights[i];
+				mix[i][secondTable] += weights[i];
+			}
+		});
+		return mix;
+	};
+	auto requireSmooth = [](const std::vector<std::array<float, 5>>& mix, std::array<float, 5> previous) {
+		for (const auto& shares : mix) {
+			for (int frame = 0; frame < 5; ++frame) {
+				REQUIRE(std::abs(shares[frame] - previous[frame]) < 0.1001f); // 10 samples per frame
+			}
+			previous = shares;
+		}
+	};
+
+	Butterfly::MorphGlide glide;
+	glide.setSamplesPerFrame(10);
+	glide.setNumFrames(5);
+	glide.process(1, std::vector<float>(1).data(), [](int, int, int, int) {});
+
+	SECTION("across all frames: ramp, direct crossfade, ramp") {
+		glide.setTarget(1.f);
+		const auto mix = glideMix(glide, 40);
+		requireSmooth(mix, { 1.f, 0.f, 0.f, 0.f, 0.f });
+		REQUIRE(mix[9][1] == Approx(1.f));		// first ramp to the next frame
+		REQUIRE(mix[19][3] == Approx(1.f));		// crossfade to the frame before the last
+		REQUIRE(mix[29][4] == Approx(1.f));
+		REQUIRE(mix[39][4] == 1.f);
+		REQUIRE_FALSE(glide.isGliding());
+		for (const auto& shares : mix) {
+			REQUIRE(shares[2] == 0.f);			// skipped
+		}
+	}
+
+	SECTION("turning back during the crossfade") {
+		glide.setTarget(1.f);
+		glideMix(glide, 40);
+		glide.setTarget(0.f);
+		const auto before = glideMix(glide, 15);
+		requireSmooth(before, { 0.f, 0.f, 0.f, 0.f, 1.f });
+		REQUIRE(before[14][3] == Approx(0.5f));	// half way from the fourth frame to the second one
+		glide.setTarget(1.f);
+		const auto back = glideMix(glide, 15);
+		requireSmooth(back, before.back());
+		REQUIRE(back[4][3] == Approx(1.f));
+		REQUIRE(back[14][4] == Approx(1.f));
+		REQUIRE_FALSE(glide.isGliding());
+	}
+
+	SECTION("the same target again during the crossfade keeps going") {
+		Butterfly::MorphGlide resent;
+		resent.setSamplesPerFrame(10);
+		resent.setNumFrames(5);
+		resent.setTarget(1.f);
+		glideMix(resent, 40);
+		resent.setTarget(0.f);
+		const auto before = glideMix(resent, 15);
+		resent.setTarget(0.f);
+		const auto after = glideMix(resent, 25);
+		requireSmooth(after, before.back());
+		REQUIRE(after[4][1] == Approx(1.f));
+		REQUIRE(after[24][0] == 1.f);
+		REQUIRE_FALSE(resent.isGliding());
+	}
+}
+
+
+TEST_CASE("Morph glide rendering") {
+	Butterfly::AudioProcessor processor;
+	processor.init(440., 48000.);
+	Butterfly::AudioProcessor::State state;
+	const auto tables = makeSineTables(256, { 24000.f });
+	state.add(tables, 1.f);
+	state.add(tables, -1.f);
+	state.add(tables, 0.5f);
+	processor.changeState(std::move(state));
+
+	// glide time set with the position applies to it
+	processor.addParamEvent({ Butterfly::ParameterType::morphGlide, 100. });
+	processor.addParamEvent({ Butterfly::ParameterType::morphPos, 1. });
+	std::vector<double> output(300);
+	double* channels[]{ output.data() };
+	c74::min::audio_bundle buffer{ channels, 1, output.size() };
+	processor.process(buffer);
+
+	auto reference = [](int i) { return std::sin(2. * M_PI * 440. * i / 48000.); };
+	auto frameGain = [](int i) {
+		if (i < 100) { return 1. - 2. * (i + 1) / 100.; }
+		return i < 200 ? -1. + 1.5 * (i - 99) / 100. : 0.5;
+	};
+	for (int i = 0; i < 300; i += 3) {
+		REQUIRE(output[i] == Approx(frameGain(i) * reference(i)).margin(1e-3));
+	}
+}
+
+
+TEST_CASE("Hard sync") {
+	const auto& minBlep = Butterfly::MinBlep::get();
+	SECTION("minBLEP residual goes from -1 to 0") {
+		REQUIRE(minBlep.residual(0.f) < -0.9f);
+		REQUIRE(minBlep.residual(Butterfly::MinBlep::length - 0.01f) == Approx(0.).margin(1e-3));
+		REQUIRE(minBlep.residual(Butterfly::MinBlep::length + 1.f) == 0.f);
+		for (float t = 0.f; t < Butterfly::MinBlep::length; t += 0.1f) {
+			REQUIRE(std::abs(minBlep.residual(t)) < 1.1f); // Gibbs overshoot only
+		}
+	}
+
+	SECTION("phase resets between samples, smoothed by the minBLEP") {
+		const auto tables = makeSineTables(1024, { 24000.f });
+		const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get() };
+		const std::vector<float> gains{ 1.f };
+
+		// upward crossings at 10.25 and 120.5, the second one's correction reaches into the next block
+		std::vector<double> sync(200, 1.);
+		for (int i = 0; i <= 11; ++i) {
+			sync[i] = i - 10.25;
+		}
+		std::fill(sync.begin() + 60, sync.begin() + 120, -1.);
+		sync[120] = -0.5;
+		sync[121] = 0.5;
+		std::vector<double> frequency(200, 300.);
+		std::vector<float> left(200), right(200);
+		const double increment = 300. / 48000.;
+		const double crossings[]{ 10.25, 120.5 };
+		const double heights[]{ -std::sin(2. * M_PI * 10.25 * increment), -std::sin(2. * M_PI * (120.5 - 10.25) * increment) };
+
+		for (const auto* frequencySignal : { static_cast<const double*>(nullptr), static_cast<const double*>(frequency.data()) }) {
+			Butterfly::MorphingBlockOscillator osc;
+			osc.setSampleRate(48000.);
+			osc.setFrequency(300.);
+			osc.setWaveforms(waveforms, gains);
+			osc.process(left.data(), right.data(), 200, nullptr, frequencySignal, sync.data());
+			for (int i = 0; i < 200; ++i) {
+				const double start = i <= 10 ? 0. : i <= 120 ? crossings[0] : crossings[1];
+				double expected = std::sin(2. * M_PI * (i - start) * increment);
+				for (int e = 0; e < 2; ++e) {
+					if (i > crossings[e]) { expected += heights[e] * minBlep.residual(static_cast<float>(i - crossings[e])); }
+				}
+				REQUIRE(left[i] == Approx(expected).margin(1e-3));
+			}
+		}
+	}
+}
+
+
+TEST_CASE("Oversampling") {
+	SECTION("half-band decimator passes most of the output band and rejects what would alias into it") {
+		auto amplitude = [](double frequency) { // relative to the input sample rate
+			Butterfly::HalfbandDecimator decimator;
+			std::vector<float> in(256), out(128);
+			double peak{};
+			for (int block = 0; block < 4; ++block) {
+				for (int i = 0; i < 256; ++i) {
+					in[i] = static_cast<float>(std::sin(2. * M_PI * frequency * (256 * block + i)));
+				}
+				decimator.process(in.data(), out.data(), 128);
+				for (int i = 0; block > 0 && i < 128; ++i) { // after the filter has filled
+					peak = std::max(peak, std::abs(static_cast<double>(out[i])));
+				}
+			}
+			return peak;
+		};
+		REQUIRE(amplitude(0.01) == Approx(1.).margin(1e-3));
+		REQUIRE(amplitude(0.18) == Approx(1.).margin(1e-2));
+		REQUIRE(amplitude(0.3) < 1e-3);
+		REQUIRE(amplitude(0.45) < 1e-3);
+	}
+
+	SECTION("oversampled rendering matches the plain one, delayed by the decimators") {
+		for (const int factor : { 2, 4 }) {
+			Butterfly::AudioProcessor processor;
+			processor.init(1000., 48000.);
+			Butterfly::AudioProcessor::State state;
+			state.add(makeSineTables(1024, { 96000.f }), 1.f);
+			processor.changeState(std::move(state));
+			processor.addParamEvent({ Butterfly::ParameterType::oversampling, static_cast<double>(factor) });
+			std::vector<double> output(300);
+			double* channels[]{ output.data() };
+			c74::min::audio_bundle buffer{ channels, 1, output.size() };
+			processor.process(buffer);
+
+			// 2 * halfLength - 1 samples at the input rate of each stage
+			const double delay = factor == 2 ? 15.5 : 31. / 4. + 15.5;
+			for (int i = 40; i < 300; i += 7) {
+				REQUIRE(output[i] == Approx(std::sin(2. * M_PI * 1000. * (i - delay) / 48000.)).margin(1e-3));
+			}
+		}
+	}
+}
+
+
+// Per-block cost of getting the current state on the audio thread while the UI thread keeps publishing.
+// Run explicitly with the [benchmark] tag.
+TEST_CASE("State handoff benchmark", "[.][benchmark]") {
+	using State = Butterfly::AudioProcessor::State;
+	constexpr int numBlocks = 2000000;
+
+	auto measure = [](auto&& publish, auto&& acquire) {
+		std::atomic<bool> running{ true };
+		std::thread writer{ [&] {
+			while (running) {
+				publish(makeState(16));
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			}
+		} };
+		const State* sink{};
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < numBlocks; ++i) {
+			sink = std::max<const State*>(sink, acquire());
+		}
+		const auto end = std::chrono::steady_clock::now();
+		running = false;
+		writer.join();
+		REQUIRE(sink != nullptr);
+		return std::chrono::duration<double, std::nano>(end - start).count() / numBlocks;
+	};
+
+	std::shared_ptr<State> sharedState = makeState(16);
+	const auto atomicSharedPtr = measure([&](std::shared_ptr<State> state) { std::atomic_store(&sharedState, std::move(state)); },
+		[&] { return std::atomic_load(&sharedState).get(); });
+
+	Butterfly::StateHandoff<State> handoff;
+	Butterfly::ReleasePool<State> releasePool;
+	handoff.publish(makeState(16));
+	const auto stateHandoff = measure([&](std::shared_ptr<State> state) {
+		releasePool.add(state);
+		handoff.publish(std::move(state));
+		releasePool.clearUnused(); },
+		[&] { return handoff.acquire(); });
+
+	WARN("std::atomic_load(shared_ptr): " << atomicSharedPtr << " ns per block");
+	WARN("StateHandoff::acquire():      " << stateHandoff << " ns per block");
+}
+
+
+// Per-instance cost of the FFTCalculator before and after sharing it. Run explicitly with the [benchmark] tag, against the
+// Butterfly library: numbers from a stubbed FFTCalculator say nothing.
+TEST_CASE("FFT calculator instantiation benchmark", "[.][benchmark]") {
+	constexpr int numInstances = 64;
+	using Clock = std::chrono::steady_clock;
+	using Calculator = Butterfly::FFTCalculator<float, 2048>;
+
+	// before: every object built its own calculator
+	const auto ownStart = Clock::now();
+	for (int i = 0; i < numInstances; ++i) {
+		auto calculator = std::make_unique<const Calculator>();
+		REQUIRE(calculator != nullptr);
+	}
+	const auto own = std::chrono::duration<double, std::micro>(Clock::now() - ownStart).count() / numInstances;
+
+	// after: the first object pays for the construction once, all others only for the lookup
+	const auto firstStart = Clock::now();
+	const auto* shared = &Butterfly::sharedFFTCalculator<2048>();
+	const auto first = std::chrono::duration<double, std::micro>(Clock::now() - firstStart).count();
+	const auto lookupStart = Clock::now();
+	for (int i = 0; i < numInstances; ++i) {
+		REQUIRE(&Butterfly::sharedFFTCalculator<2048>() == shared);
+	}
+	const auto lookup = std::chrono::duration<double, std::micro>(Clock::now() - lookupStart).count() / numInstances;
+
+	WARN("own FFTCalculator<float, 2048>:  " << own << " us and " << sizeof(Calculator) << " bytes inline per instance");
+	WARN("sharedFFTCalculator<2048>():     " << first << " us for the first instance (only the lookup if another test built it), "
+		<< lookup << " us per further instance");
+}
+
+
+// Export throughput per quality preset. Run explicitly with the [benchmark] tag.
+TEST_CASE("Periodic resampler benchmark", "[.][benchmark]") {
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * i / 2048.));
+	}
+	std::vector<float> out(3000);
+	const int numRuns = 200;
+
+	for (const auto quality : { Butterfly::ResamplerQuality::draft, Butterfly::ResamplerQuality::normal, Butterfly::ResamplerQuality::high }) {
+		const Butterfly::PeriodicResampler resampler{ 2048, static_cast<int>(out.size()), quality };
+		const auto start = std::chrono::steady_clock::now();
+		for (int run = 0; run < numRuns; ++run) {
+			resampler.process(samples.data(), out.data());
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		WARN("quality " << static_cast<int>(quality) << ": " << numRuns * out.size() / seconds / 1e6 << " M output samples/s");
+	}
+}
+
+
+// Cost of unison copies relative to a single oscillator. Run explicitly with the [benchmark] tag.
+TEST_CASE("Unison benchmark", "[.][benchmark]") {
+	const auto tables = makeSineTables(2048, { 24000.f });
+	const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get(), tables.get() };
+	const std::vector<float> gains{ 1.f, 1.f };
+	std::vector<float> left(Butterfly::MorphingBlockOscillator::blockSize), right(Butterfly::MorphingBlockOscillator::blockSize);
+	std::vector<double> frequencies(Butterfly::MorphingBlockOscillator::blockSize);
+	for (size_t i = 0; i < frequencies.size(); ++i) {
+		frequencies[i] = 220. + static_cast<double>(i);
+	}
+	constexpr int numBlocks = 100000;
+
+	for (const bool withSignal : { false, true }) {
+		double single{};
+		for (const int numVoices : { 1, 2, 8, 16 }) {
+			Butterfly::MorphingBlockOscillator osc;
+			osc.setSampleRate(48000.);
+			osc.setFrequency(220.);
+			osc.setWaveforms(waveforms, gains);
+			osc.setNormalizedMorphingParam(0.5);
+			osc.setUnison(numVoices, 15.f, 1.f);
+			const auto start = std::chrono::steady_clock::now();
+			for (int block = 0; block < numBlocks; ++block) {
+				osc.process(left.data(), right.data(), Butterfly::MorphingBlockOscillator::blockSize, nullptr, withSignal ? frequencies.data() : nullptr);
+			}
+			const auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numBlocks;
+			if (numVoices == 1) { single = ns; }
+			WARN(numVoices << " unison voices" << (withSignal ? ", frequency signal: " : ": ") << ns << " ns per block, " << ns / single << " x one voice");
+		}
+	}
+}
+
+
+// Voices of a chord, each in its own band, against the same number of voices in one band. Run explicitly with the [benchmark] tag.
+TEST_CASE("Polyphony benchmark", "[.][benchmark]") {
+	std::vector<float> samples(2048);
+	for (size_t i = 0; i < samples.size(); ++i) {
+		samples[i] = static_cast<float>(std::sin(2. * M_PI * i / 2048.));
+	}
+	const Butterfly::SpectralFrame spectrum{ samples };
+	const auto splitFreqs = Butterfly::calculateSplitFreqs(2.f, 24000.f, 5.f);
+	const auto tables = Butterfly::synthesizeMultitable(spectrum, splitFreqs, 48000.f, { 0, splitFreqs.size() - 1 });
+	const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get(), tables.get() };
+	const std::vector<float> gains{ 1.f, 1.f };
+	std::vector<float> left(Butterfly::MorphingBlockOscillator::blockSize), right(Butterfly::MorphingBlockOscillator::blockSize);
+	constexpr int numBlocks = 100000;
+
+	const std::vector<int> chord{ 48, 52, 55, 60, 64, 67, 72, 76 };
+	for (const bool sameBand : { false, true }) {
+		Butterfly::MorphingBlockOscillator osc;
+		osc.setSampleRate(48000.);
+		osc.setWaveforms(waveforms, gains);
+		osc.setNormalizedMorphingParam(0.5);
+		Butterfly::VoiceBank voices;
+		voices.setNumVoices(8);
+		for (int v = 0; v < 8; ++v) {
+			voices.noteOn(chord[v], 127.f);
+			if (sameBand) { voices.frequencies[v] = 261.63f * (1.f + 0.001f * v); } // detuned middle C
+		}
+		const auto start = std::chrono::steady_clock::now();
+		for (int block = 0; block < numBlocks; ++block) {
+			osc.processVoices(left.data(), right.data(), Butterfly::MorphingBlockOscillator::blockSize, voices);
+		}
+		const auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numBlocks;
+		WARN((sameBand ? "8 voices, 1 band:  " : "8 voices, 8 bands: ") << ns << " ns per block");
+	}
+}
+
+
+// Hard sync against the free-running oscillator, the sync signal resets the phase about once per block
+TEST_CASE("Hard sync benchmark", "[.][benchmark]") {
+	const auto tables = makeSineTables(2048, { 24000.f });
+	const std::vector<const Butterfly::FrameTables*> waveforms{ tables.get(), tables.get() };
+	const std::vector<float> gains{ 1.f, 1.f };
+	std::vector<float> left(Butterfly::MorphingBlockOscillator::blockSize), right(Butterfly::MorphingBlockOscillator::blockSize);
+	std::vector<double> sync(Butterfly::MorphingBlockOscillator::blockSize * 100);
+	for (size_t i = 0; i < sync.size(); ++i) {
+		sync[i] = std::sin(2. * M_PI * 1050. * i / 48000.);
+	}
+	constexpr int numBlocks = 100000;
+
+	for (const bool synced : { false, true }) {
+		Butterfly::MorphingBlockOscillator osc;
+		osc.setSampleRate(48000.);
+		osc.setFrequency(220.);
+		osc.setWaveforms(waveforms, gains);
+		osc.setNormalizedMorphingParam(0.5);
+		const auto start = std::chrono::steady_clock::now();
+		for (int block = 0; block < numBlocks; ++block) {
+			const double* syncSignal = synced ? sync.data() + Butterfly::MorphingBlockOscillator::blockSize * (block % 100) : nullptr;
+			osc.process(left.data(), right.data(), Butterfly::MorphingBlockOscillator::blockSize, nullptr, nullptr, syncSignal);
+		}
+		const auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / numBlocks;
+		WARN((synced ? "synced: " : "free running: ") << ns << " ns per block");
+	}
+}
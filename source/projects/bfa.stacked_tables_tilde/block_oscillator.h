@@ -0,0 +1,431 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <span>
+#include <utility>
+#include <vector>
+#include "frame_tables.h"
+#include "min_blep.h"
+#include "morph_glide.h"
+#include "render_kernels.h"
+#include "voice_bank.h"
+
+namespace Butterfly {
+
+/// Morphing wavetable oscillator that renders in blocks. Phases, the band (mip level) and the morph
+/// weights are computed for a whole block up front, lookup and crossfade run in interpolateAndCrossfade().
+/// Morph changes glide (see MorphGlide), by default over one block per frame of distance. A morph signal
+/// replaces the glide with one morph position per sample, a frequency signal the fixed increment with one
+/// increment per sample. The band then follows the highest frequency of each block. A sync signal resets the phase
+/// at its upward zero crossings, between samples, and the step this causes is smoothed with a minBLEP.
+/// With unison, several detuned copies of the oscillator are rendered side by side, one per SIMD lane, and panned
+/// across the stereo field. processVoices() renders the voices of a VoiceBank instead, all reading the same frames.
+class MorphingBlockOscillator
+{
+public:
+	static constexpr int blockSize = 64;
+	static constexpr int maxUnisonVoices = 16;
+
+	MorphingBlockOscillator() : minBlep(&MinBlep::get()) {
+		centerPans.fill(1.f);
+		setUnison(1, 0.f, 0.f);
+		setMorphGlide(blockSize);
+	}
+
+	void setSampleRate(double sampleRate) {
+		this->sampleRate = sampleRate;
+		updateIncrement();
+	}
+
+	void setFrequency(double frequency) {
+		this->frequency = frequency;
+		updateIncrement();
+		updateBand();
+	}
+
+	void setNormalizedMorphingParam(double morphPos) {
+		glide.setTarget(static_cast<float>(morphPos));
+	}
+
+	/// @param samplesPerFrame  glide time for a morph distance of one frame
+	void setMorphGlide(int samplesPerFrame) {
+		glide.setSamplesPerFrame(samplesPerFrame);
+	}
+
+	/// @param numVoices    detuned copies, 1 is a single oscillator
+	/// @param detuneCents  detune of the outermost copies, the others are spread evenly in between
+	/// @param width        0: all copies in the center, 1: outermost copies hard left and right
+	void setUnison(int numVoices, float detuneCents, float width) {
+		const bool respread = std::clamp(numVoices, 1, maxUnisonVoices) != numUnisonVoices;
+		numUnisonVoices = std::clamp(numVoices, 1, maxUnisonVoices);
+		const float level = 1.f / std::sqrt(static_cast<float>(numUnisonVoices));
+		for (int k = 0; k < maxUnisonVoices; ++k) {
+			const float offset = numUnisonVoices > 1 ? 2.f * static_cast<float>(k) / static_cast<float>(numUnisonVoices - 1) - 1.f : 0.f;
+			unisonRatios[k] = std::exp2(offset * detuneCents / 1200.f);
+			unisonLevels[k] = k < numUnisonVoices ? level : 0.f;
+			// constant power panning, unity gain in the center
+			const float angle = (std::clamp(offset * width, -1.f, 1.f) + 1.f) * 0.25f * 3.14159265f;
+			unisonPansLeft[k] = std::sqrt(2.f) * std::cos(angle);
+			unisonPansRight[k] = std::sqrt(2.f) * std::sin(angle);
+			// spread start phases, so the copies don't start out in phase
+			if (respread) { unisonPhases[k] = std::fmod(static_cast<float>(k) * 0.618034f, 1.f); }
+		}
+	}
+
+	/// @param waveforms  tables of all frames, all frames sharing the same band layout
+	/// @param gains      gain and polarity per frame, applied while rendering
+	void setWaveforms(std::span<const FrameTables* const> waveforms, std::span<const float> gains) {
+		this->waveforms = waveforms;
+		this->gains = gains;
+		glide.setNumFrames(static_cast<int>(waveforms.size()));
+		updateBand();
+	}
+
+	// Audio thread
+	/// @param morphSignal      n morph positions in [0, 1], nullptr: glide to the position set with setNormalizedMorphingParam()
+	/// @param frequencySignal  n frequencies in Hz, nullptr: the frequency set with setFrequency()
+	/// @param syncSignal       n samples, the phase restarts where it crosses zero upwards, nullptr: free running
+	/// With unison, the sync signal isn't used.
+	void process(float* outLeft, float* outRight, int n, const double* morphSignal = nullptr, const double* frequencySignal = nullptr,
+		const double* syncSignal = nullptr) {
+		while (n > 0) {
+			const int count = std::min(n, blockSize);
+			processBlock(outLeft, outRight, count, morphSignal, frequencySignal, syncSignal);
+			outLeft += count;
+			outRight += count;
+			if (morphSignal) { morphSignal += count; }
+			if (frequencySignal) { frequencySignal += count; }
+			if (syncSignal) { syncSignal += count; }
+			n -= count;
+		}
+	}
+
+	// Audio thread
+	/// @brief Renders the sum of all active voices. The frequency set with setFrequency() isn't used.
+	void processVoices(float* outLeft, float* outRight, int n, VoiceBank& voices, const double* morphSignal = nullptr) {
+		while (n > 0) {
+			const int count = std::min(n, blockSize);
+			processVoicesBlock(outLeft, outRight, count, voices, morphSignal);
+			outLeft += count;
+			outRight += count;
+			if (morphSignal) { morphSignal += count; }
+			n -= count;
+		}
+	}
+
+private:
+	void processBlock(float* outLeft, float* outRight, int n, const double* morphSignal, const double* frequencySignal, const double* syncSignal) {
+		if (waveforms.empty()) {
+			std::fill_n(outLeft, n, 0.f);
+			std::fill_n(outRight, n, 0.f);
+			return;
+		}
+		if (numUnisonVoices > 1) {
+			processUnisonBlock(outLeft, outRight, n, morphSignal, frequencySignal);
+			return;
+		}
+
+		size_t blockBand = band;
+		if (frequencySignal) {
+			const float maxFrequency = accumulatePhases(frequencySignal, static_cast<float>(1. / sampleRate), phase, phases.data(), n);
+			blockBand = bandFor(maxFrequency);
+		} else {
+			for (int i = 0; i < n; ++i) {
+				phases[i] = std::min(static_cast<float>(phase), maxPhase);
+				phase += increment;
+				if (phase >= 1.) { phase -= 1.; }
+			}
+		}
+		numSyncEvents = 0;
+		if (syncSignal) { applySync(n, syncSignal, frequencySignal); }
+
+		computeMorphWeights(n, morphSignal);
+		int nextSyncEvent = 0;
+		forEachRun([&](int firstTable, int secondTable, int begin, int end) {
+			const auto [tableA, tableB] = selectBands(*waveforms[firstTable], *waveforms[secondTable], blockBand);
+			interpolateAndCrossfade(tableA.data, tableB.data, tableA.size, phases.data() + begin, morphWeights.data() + begin, outLeft + begin, end - begin,
+				gains[firstTable], gains[secondTable]);
+			// height of each phase reset, the waveform at phase 0 minus the one at the phase it would have had
+			for (; nextSyncEvent < numSyncEvents && syncEvents[nextSyncEvent].index < end; ++nextSyncEvent) {
+				const auto& event = syncEvents[nextSyncEvent];
+				const float stepPhases[2]{ 0.f, event.phaseBefore };
+				const float stepMorph[2]{ morphWeights[event.index], morphWeights[event.index] };
+				float values[2];
+				interpolateAndCrossfade(tableA.data, tableB.data, tableA.size, stepPhases, stepMorph, values, 2, gains[firstTable], gains[secondTable]);
+				minBlep->addStep(blepBuffer.data() + event.index, event.sinceCrossing, values[0] - values[1]);
+				blepSamplesPending = std::max(blepSamplesPending, event.index + MinBlep::length);
+			}
+		});
+		if (blepSamplesPending > 0) { addBlepCorrections(outLeft, n); }
+		std::copy_n(outLeft, n, outRight);
+	}
+
+	// Resets the phases at the upward zero crossings of the sync signal. The reset happens between two samples,
+	// the phase of the sample after it is what the oscillator advanced since the crossing.
+	void applySync(int n, const double* syncSignal, const double* frequencySignal) {
+		auto wrap = [](double phase) { return phase - std::floor(phase); };
+		float shift{}; // from begin on, in (-1, 1)
+		int numEvents = 0, begin = 0;
+		for (int i = findUpwardCrossing(syncSignal, previousSync, n); i < n; i += 1 + findUpwardCrossing(syncSignal + i + 1, syncSignal[i], n - i - 1)) {
+			if (shift != 0.f) { shiftPhases(phases.data() + begin, shift, i - begin); }
+			const double sync = syncSignal[i];
+			const double beforeSync = i > 0 ? syncSignal[i - 1] : previousSync;
+			const double sampleIncrement = frequencySignal ? sanitizeFrequency(frequencySignal[i], static_cast<float>(sampleRate)) / sampleRate : increment;
+			const double sinceCrossing = sync / (sync - beforeSync); // (0, 1] samples
+			const double phaseBefore = wrap(phases[i] + shift - sinceCrossing * sampleIncrement);
+			shift = static_cast<float>(wrap(sinceCrossing * sampleIncrement) - phases[i]);
+			syncEvents[numEvents++] = { i, static_cast<float>(sinceCrossing), std::min(static_cast<float>(phaseBefore), maxPhase) };
+			begin = i;
+		}
+		if (shift != 0.f) { shiftPhases(phases.data() + begin, shift, n - begin); }
+		previousSync = syncSignal[n - 1];
+		numSyncEvents = numEvents;
+		phase = wrap(phase + shift);
+	}
+
+	// Adds the minBLEP corrections due in this block and keeps the rest for the next one
+	void addBlepCorrections(float* out, int n) {
+		for (int i = 0; i < std::min(n, blepSamplesPending); ++i) {
+			out[i] += blepBuffer[i];
+		}
+		std::copy(blepBuffer.begin() + n, blepBuffer.begin() + n + MinBlep::length, blepBuffer.begin());
+		std::fill(blepBuffer.begin() + MinBlep::length, blepBuffer.begin() + n + MinBlep::length, 0.f);
+		blepSamplesPending -= n;
+	}
+
+	void processUnisonBlock(float* outLeft, float* outRight, int n, const double* morphSignal, const double* frequencySignal) {
+		// the copies are detuned by a fixed ratio, with a frequency signal each increment is ratio / sampleRate scaled by the
+		// frequency of the sample. The highest copy is the last one.
+		const float highestRatio = unisonRatios[numUnisonVoices - 1];
+		const float* frequencies = nullptr;
+		double blockFrequency = std::abs(frequency);
+		if (frequencySignal) {
+			const float limit = static_cast<float>(maxPhase * sampleRate / highestRatio);
+			float maxFrequency{};
+			for (int i = 0; i < n; ++i) {
+				unisonFrequencies[i] = sanitizeFrequency(frequencySignal[i], limit);
+				maxFrequency = std::max(maxFrequency, std::abs(unisonFrequencies[i]));
+			}
+			frequencies = unisonFrequencies.data();
+			blockFrequency = maxFrequency;
+		}
+		const double invSampleRate = 1. / sampleRate;
+		for (int k = 0; k < numUnisonVoices; ++k) {
+			unisonIncrements[k] = frequencies ? static_cast<float>(unisonRatios[k] * invSampleRate)
+				: std::min(static_cast<float>(blockFrequency * unisonRatios[k] * invSampleRate), maxPhase);
+		}
+		const size_t blockBand = bandFor(blockFrequency * highestRatio);
+
+		std::fill_n(outLeft, n, 0.f);
+		std::fill_n(outRight, n, 0.f);
+		computeMorphWeights(n, morphSignal);
+		forEachRun([&](int firstTable, int secondTable, int begin, int end) {
+			const auto [tableA, tableB] = selectBands(*waveforms[firstTable], *waveforms[secondTable], blockBand);
+			unisonSizes.fill(tableA.size);
+			renderVoiceLanes(tableA.data, tableB.data, unisonOffsets.data(), unisonOffsets.data(), unisonSizes.data(), morphWeights.data() + begin, nullptr,
+				gains[firstTable], gains[secondTable], unisonPhases.data(), unisonIncrements.data(), frequencies ? frequencies + begin : nullptr, unisonLevels.data(), unisonLevelSteps.data(),
+				unisonPansLeft.data(), unisonPansRight.data(), numUnisonVoices, outLeft + begin, outRight + begin, end - begin);
+		});
+	}
+
+	void processVoicesBlock(float* outLeft, float* outRight, int n, VoiceBank& voices, const double* morphSignal) {
+		std::fill_n(outLeft, n, 0.f);
+		std::fill_n(outRight, n, 0.f);
+		if (waveforms.empty()) { return; }
+
+		voices.prepareBlock(n, static_cast<float>(1. / sampleRate));
+		// all active voices are rendered together, one per SIMD lane, each from its own band. The voices that follow the
+		// morph position of the oscillator come first, then those with their own, grouped by their pair of frames.
+		const int numTables = static_cast<int>(waveforms.size());
+		std::array<int, VoiceBank::maxVoices> laneVoices{}, laneFirstTables{};
+		std::array<size_t, VoiceBank::maxVoices> laneBands{};
+		int numLanes = 0;
+		auto addLane = [&](int v) {
+			laneVoices[numLanes] = v;
+			laneBands[numLanes] = bandFor(voices.frequencies[v]);
+			lanePhases[numLanes] = voices.phases[v];
+			laneIncrements[numLanes] = voices.increments[v];
+			laneLevels[numLanes] = voices.levels[v];
+			laneLevelSteps[numLanes] = voices.levelSteps[v];
+			++numLanes;
+		};
+		std::array<std::pair<int, int>, VoiceBank::maxVoices> ownMorphVoices{}; // first frame, voice
+		int numOwnMorphVoices = 0;
+		for (int v = 0; v < VoiceBank::maxVoices; ++v) {
+			if (!voices.active[v]) { continue; }
+			if (!voices.ownMorph[v]) {
+				addLane(v);
+				continue;
+			}
+			const int firstTable = std::min(static_cast<int>(voices.morphs[v] * static_cast<float>(numTables - 1)), std::max(numTables - 2, 0));
+			ownMorphVoices[numOwnMorphVoices++] = { firstTable, v };
+		}
+		const int numSharedMorphLanes = numLanes;
+		std::sort(ownMorphVoices.begin(), ownMorphVoices.begin() + numOwnMorphVoices);
+		for (int i = 0; i < numOwnMorphVoices; ++i) {
+			const auto [firstTable, v] = ownMorphVoices[i];
+			laneFirstTables[numLanes] = firstTable;
+			laneMorphs[numLanes] = numTables > 1 ? voices.morphs[v] * static_cast<float>(numTables - 1) - static_cast<float>(firstTable) : 0.f;
+			addLane(v);
+		}
+
+		// renders count lanes from firstLane on, offsets into the slabs of the two frames are relative to the tables of firstLane
+		auto renderLanes = [&](int firstTable, int secondTable, int firstLane, int count, const float* morph, int begin, int end) {
+			const auto& framesA = *waveforms[firstTable];
+			const auto& framesB = *waveforms[secondTable];
+			const auto [baseA, baseB] = selectBands(framesA, framesB, laneBands[firstLane]);
+			for (int lane = firstLane; lane < firstLane + count; ++lane) {
+				const auto [tableA, tableB] = selectBands(framesA, framesB, laneBands[lane]);
+				laneOffsetsA[lane] = static_cast<int32_t>(tableA.data - baseA.data);
+				laneOffsetsB[lane] = static_cast<int32_t>(tableB.data - baseB.data);
+				laneSizes[lane] = tableA.size;
+			}
+			renderVoiceLanes(baseA.data, baseB.data, laneOffsetsA.data() + firstLane, laneOffsetsB.data() + firstLane, laneSizes.data() + firstLane,
+				morph, laneMorphs.data() + firstLane, gains[firstTable], gains[secondTable], lanePhases.data() + firstLane, laneIncrements.data() + firstLane,
+				nullptr, laneLevels.data() + firstLane, laneLevelSteps.data() + firstLane, centerPans.data(), centerPans.data(), count,
+				outLeft + begin, outRight + begin, end - begin);
+		};
+
+		computeMorphWeights(n, morphSignal);
+		if (numSharedMorphLanes > 0) {
+			forEachRun([&](int firstTable, int secondTable, int begin, int end) {
+				renderLanes(firstTable, secondTable, 0, numSharedMorphLanes, morphWeights.data() + begin, begin, end);
+			});
+		}
+		for (int lane = numSharedMorphLanes; lane < numLanes;) {
+			const int firstTable = laneFirstTables[lane];
+			int end = lane + 1;
+			while (end < numLanes && laneFirstTables[end] == firstTable) {
+				++end;
+			}
+			renderLanes(firstTable, std::min(firstTable + 1, numTables - 1), lane, end - lane, nullptr, 0, n);
+			lane = end;
+		}
+
+		for (int lane = 0; lane < numLanes; ++lane) {
+			voices.phases[laneVoices[lane]] = lanePhases[lane];
+			voices.levels[laneVoices[lane]] = laneLevels[lane];
+		}
+		voices.finishBlock();
+	}
+
+	// Crossfade weights and the runs of samples that read the same pair of frames, see forEachRun()
+	void computeMorphWeights(int n, const double* morphSignal) {
+		numRuns = 0;
+		if (!morphSignal) {
+			glide.process(n, morphWeights.data(), [this](int firstTable, int secondTable, int begin, int end) {
+				runs[numRuns++] = { firstTable, secondTable, begin, end };
+			});
+			return;
+		}
+		scaleMorphSignal(morphSignal, static_cast<float>(waveforms.size() - 1), morphWeights.data(), n);
+		// glides back to the target from here when the signal goes away
+		glide.jumpTo(static_cast<float>(morphSignal[n - 1]));
+
+		// split into runs of adjacent frames, with the weights relative to the first frame of each run
+		const int numTables = static_cast<int>(waveforms.size());
+		const int lastFirstTable = std::max(numTables - 2, 0);
+		int begin = 0;
+		while (begin < n) {
+			const int firstTable = std::min(static_cast<int>(morphWeights[begin]), lastFirstTable);
+			int end = begin + 1;
+			while (end < n && std::min(static_cast<int>(morphWeights[end]), lastFirstTable) == firstTable) {
+				++end;
+			}
+			for (int i = begin; i < end; ++i) {
+				morphWeights[i] -= static_cast<float>(firstTable);
+			}
+			runs[numRuns++] = { firstTable, std::min(firstTable + 1, numTables - 1), begin, end };
+			begin = end;
+		}
+	}
+
+	// Calls f(firstTable, secondTable, begin, end) for each run of computeMorphWeights(), with the morph weights of the
+	// run between firstTable (0) and secondTable (1)
+	template<class F>
+	void forEachRun(F&& f) {
+		for (int r = 0; r < numRuns; ++r) {
+			f(runs[r].firstTable, runs[r].secondTable, runs[r].begin, runs[r].end);
+		}
+	}
+
+	// Each band has its own length, but the same in all frames (see createFrame()). Frames may hold a subset
+	// of the bands only (spectral storage), both tables are taken from the bands the two frames have in common.
+	std::pair<const TableSpan&, const TableSpan&> selectBands(const FrameTables& a, const FrameTables& b, size_t band) const {
+		const auto idx = std::clamp(band, std::max(a.firstBand(), b.firstBand()), std::min(a.lastBand(), b.lastBand()));
+		return { a.band(idx - a.firstBand()), b.band(idx - b.firstBand()) };
+	}
+
+	void updateIncrement() {
+		increment = sampleRate > 0. ? frequency / sampleRate : 0.;
+	}
+
+	void updateBand() {
+		if (waveforms.empty()) { return; }
+		band = bandFor(frequency);
+	}
+
+	// Lowest band that can be played back at frequency without aliasing, as index into the full layout
+	size_t bandFor(double frequency) const {
+		const auto& tables = *waveforms.front();
+		const auto bands = tables.bands();
+		const auto it = std::find_if(bands.begin(), bands.end(), [frequency](const TableSpan& table) { return table.maxPlaybackFrequency >= frequency; });
+		return tables.firstBand() + (it == bands.end() ? bands.size() - 1 : static_cast<size_t>(std::distance(bands.begin(), it)));
+	}
+
+	static constexpr float maxPhase = 0.99999994f; // largest float below 1
+
+	std::span<const FrameTables* const> waveforms;
+	std::span<const float> gains;
+	double sampleRate{ 48000. }, frequency{ 10. };
+	double phase{}, increment{};
+	size_t band{};
+	MorphGlide glide;
+	struct Run
+	{
+		int firstTable{}, secondTable{}, begin{}, end{};
+	};
+	std::array<Run, blockSize> runs{};
+	int numRuns{};
+
+	struct SyncEvent
+	{
+		int index{};				// first sample after the phase reset
+		float sinceCrossing{};		// samples between the zero crossing and index
+		float phaseBefore{};		// phase at the crossing without the reset
+	};
+	const MinBlep* minBlep;
+	double previousSync{};
+	std::array<SyncEvent, blockSize> syncEvents{};
+	int numSyncEvents{};
+	std::array<float, blockSize + MinBlep::length> blepBuffer{};	// corrections of this block and the tail of its last steps
+	int blepSamplesPending{};
+
+	alignas(32) std::array<float, blockSize> phases{};
+	alignas(32) std::array<float, blockSize> morphWeights{};
+	alignas(32) std::array<float, VoiceBank::maxVoices> lanePhases{};
+	alignas(32) std::array<float, VoiceBank::maxVoices> laneIncrements{};
+	alignas(32) std::array<float, VoiceBank::maxVoices> laneLevels{};
+	alignas(32) std::array<float, VoiceBank::maxVoices> laneLevelSteps{};
+	alignas(32) std::array<float, VoiceBank::maxVoices> laneMorphs{};
+	alignas(32) std::array<float, VoiceBank::maxVoices> centerPans{};
+	alignas(32) std::array<int32_t, VoiceBank::maxVoices> laneOffsetsA{};
+	alignas(32) std::array<int32_t, VoiceBank::maxVoices> laneOffsetsB{};
+	alignas(32) std::array<int32_t, VoiceBank::maxVoices> laneSizes{};
+
+	int numUnisonVoices{};
+	std::array<float, maxUnisonVoices> unisonRatios{};
+	alignas(32) std::array<float, maxUnisonVoices> unisonPhases{};
+	alignas(32) std::array<float, maxUnisonVoices> unisonIncrements{};	// per Hz with a frequency signal
+	alignas(32) std::array<float, blockSize> unisonFrequencies{};
+	alignas(32) std::array<float, maxUnisonVoices> unisonLevels{};
+	alignas(32) std::array<float, maxUnisonVoices> unisonLevelSteps{};	// unison levels don't ramp
+	alignas(32) std::array<float, maxUnisonVoices> unisonPansLeft{};
+	alignas(32) std::array<float, maxUnisonVoices> unisonPansRight{};
+	alignas(32) std::array<int32_t, maxUnisonVoices> unisonOffsets{};	// all copies read the same band
+	alignas(32) std::array<int32_t, maxUnisonVoices> unisonSizes{};
+};
+
+}
@@ -0,0 +1,66 @@
+#include "frame_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Butterfly {
+
+FrameCache g_frameCache;
+
+
+std::shared_ptr<const FrameTables> FrameCache::getOrBuild(const Key& key, const Builder& build) {
+	const auto keyHash = hash(key);
+	{
+		std::scoped_lock lock{ mutex };
+		if (auto tables = find(keyHash, key)) { return tables; }
+	}
+
+	auto tables = build();
+
+	std::scoped_lock lock{ mutex };
+	if (auto cached = find(keyHash, key)) { return cached; }
+	std::erase_if(entries, [](const auto& entry) { return entry.second.tables.expired(); });
+	entries.emplace(keyHash, Entry{ { key.samples.begin(), key.samples.end() }, key.sampleRate, { key.splitFreqs.begin(), key.splitFreqs.end() }, tables });
+	return tables;
+}
+
+
+size_t FrameCache::size() const {
+	std::scoped_lock lock{ mutex };
+	return std::count_if(entries.begin(), entries.end(), [](const auto& entry) { return !entry.second.tables.expired(); });
+}
+
+
+// FNV-1a over the bit patterns
+uint64_t FrameCache::hash(const Key& key) {
+	uint64_t result = 14695981039346656037ull;
+	auto add = [&result](std::span<const float> values) {
+		for (const float value : values) {
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			result = (result ^ bits) * 1099511628211ull;
+		}
+	};
+	add(key.samples);
+	add({ &key.sampleRate, 1 });
+	add(key.splitFreqs);
+	return result;
+}
+
+
+bool FrameCache::matches(const Entry& entry, const Key& key) {
+	return entry.sampleRate == key.sampleRate && std::ranges::equal(entry.samples, key.samples) && std::ranges::equal(entry.splitFreqs, key.splitFreqs);
+}
+
+
+std::shared_ptr<const FrameTables> FrameCache::find(uint64_t keyHash, const Key& key) const {
+	const auto [begin, end] = entries.equal_range(keyHash);
+	for (auto it = begin; it != end; ++it) {
+		if (matches(it->second, key)) {
+			if (auto tables = it->second.tables.lock()) { return tables; }
+		}
+	}
+	return {};
+}
+
+}
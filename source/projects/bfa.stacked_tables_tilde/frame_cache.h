@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "frame_tables.h"
+
+namespace Butterfly {
+
+/// @brief Band-limited tables of identical frames, shared read-only by all instances.
+/// Entries are keyed by a hash of (samples, sample rate, split frequencies) and only hold weak references,
+/// the tables are freed as soon as no instance uses them anymore. Thread-safe.
+class FrameCache
+{
+public:
+	struct Key
+	{
+		std::span<const float> samples;
+		float sampleRate{};
+		std::span<const float> splitFreqs;
+	};
+
+	using Builder = std::function<std::shared_ptr<const FrameTables>()>;
+
+	/// @brief Returns the cached tables for key or builds them with build(), which runs without holding the lock.
+	/// Threads that build the same tables at the same time all get the tables that were inserted first.
+	std::shared_ptr<const FrameTables> getOrBuild(const Key& key, const Builder& build);
+
+	/// Number of tables that are still in use
+	size_t size() const;
+
+private:
+	struct Entry
+	{
+		std::vector<float> samples;
+		float sampleRate{};
+		std::vector<float> splitFreqs;
+		std::weak_ptr<const FrameTables> tables;
+	};
+
+	static uint64_t hash(const Key& key);
+	static bool matches(const Entry& entry, const Key& key);
+	std::shared_ptr<const FrameTables> find(uint64_t keyHash, const Key& key) const;
+
+	mutable std::mutex mutex;
+	std::unordered_multimap<uint64_t, Entry> entries;
+};
+
+
+/// All instances of bfa.stacked_tables~ can share a single copy of identical frames.
+//  Thus we create a global instance of it in our cpp file.
+
+extern FrameCache g_frameCache;
+
+}
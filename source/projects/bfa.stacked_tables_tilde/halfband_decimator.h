@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BFA_HALFBAND_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Butterfly {
+
+/// @brief Decimation by two with a half-band FIR (Kaiser-windowed sinc, 4 * halfLength - 1 taps) in polyphase form.
+/// Every other tap of a half-band filter is zero, so the odd input samples only pass the center tap and
+/// the even ones a filter of 2 * halfLength taps, run as a dot product over the contiguous even samples.
+/// Keeps its history between calls, one instance per channel and stage.
+class HalfbandDecimator
+{
+public:
+	static constexpr int halfLength = 16;
+	static constexpr int numTaps = 2 * halfLength;			// taps on the even samples
+	static constexpr int maxOutputSize = 128;				// per call
+
+	HalfbandDecimator() {
+		// h[j] with center c = 2 * halfLength - 1, the even taps j = 2q are at odd distances from the center
+		constexpr double beta = 8.;
+		constexpr int center = 2 * halfLength - 1;
+		double sum{};
+		for (int q = 0; q < numTaps; ++q) {
+			const double t = 2 * q - center;
+			const double h = std::sin(M_PI * t / 2.) / (M_PI * t) * kaiser(t / (center + 1), beta);
+			coefficients[numTaps - 1 - q] = static_cast<float>(h); // reversed for the dot product
+			sum += h;
+		}
+		for (auto& c : coefficients) {
+			c = static_cast<float>(c * 0.5 / sum); // the center tap is 0.5, unity gain at DC
+		}
+		reset();
+	}
+
+	void reset() {
+		even.fill(0.f);
+		odd.fill(0.f);
+	}
+
+	/// @param in   2 * n samples
+	/// @param out  n samples, n <= maxOutputSize
+	void process(const float* in, float* out, int n) {
+		for (int i = 0; i < n; ++i) {
+			even[numTaps - 1 + i] = in[2 * i];
+			odd[halfLength + i] = in[2 * i + 1];
+		}
+		for (int i = 0; i < n; ++i) {
+			out[i] = 0.5f * odd[i] + dot(even.data() + i);
+		}
+		std::copy_n(even.begin() + n, numTaps - 1, even.begin());
+		std::copy_n(odd.begin() + n, halfLength, odd.begin());
+	}
+
+private:
+	static double kaiser(double x, double beta) {
+		auto besselI0 = [](double x) {
+			double sum = 1., term = 1.;
+			for (int k = 1; k < 50; ++k) {
+				term *= (x / (2. * k)) * (x / (2. * k));
+				sum += term;
+			}
+			return sum;
+		};
+		return std::abs(x) >= 1. ? 0. : besselI0(beta * std::sqrt(1. - x * x)) / besselI0(beta);
+	}
+
+	float dot(const float* x) const {
+#if defined(BFA_HALFBAND_SSE2)
+		__m128 acc = _mm_setzero_ps();
+		for (int k = 0; k < numTaps; k += 4) {
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_load_ps(coefficients.data() + k)));
+		}
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, acc);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+		float acc{};
+		for (int k = 0; k < numTaps; ++k) {
+			acc += x[k] * coefficients[k];
+		}
+		return acc;
+#endif
+	}
+
+	alignas(16) std::array<float, numTaps> coefficients{};
+	std::array<float, numTaps - 1 + maxOutputSize> even{};	// history, then the even samples of this call
+	std::array<float, halfLength + maxOutputSize> odd{};	// delayed by halfLength to line up with the center tap
+};
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <vector>
+#include "shared_fft.h"
+
+namespace Butterfly {
+
+/// @brief Minimum-phase band-limited step (minBLEP) for hard sync.
+/// A step of height h between two samples is corrected by adding h * residual(t) to the samples at t >= 0 samples
+/// after it: the step of the naive signal becomes a band-limited one, and the correction is causal, so it can
+/// be added while rendering.
+/// The table is built once from a Blackman-windowed sinc, made minimum-phase via the real cepstrum and integrated.
+class MinBlep
+{
+public:
+	static constexpr int zeroCrossings = 8;
+	static constexpr int oversampling = 64;
+	static constexpr int length = 2 * zeroCrossings;	// samples affected by one step
+
+	/// Shared table, built by the first call. Call it from the UI thread first, e.g. in a constructor.
+	static const MinBlep& get() {
+		static const MinBlep minBlep;
+		return minBlep;
+	}
+
+	/// @param t  samples since the step, 0 <= t
+	float residual(float t) const {
+		const float pos = t * oversampling;
+		const int idx = static_cast<int>(pos);
+		if (idx >= length * oversampling) { return 0.f; }
+		const float frac = pos - static_cast<float>(idx);
+		return table[idx] + (table[idx + 1] - table[idx]) * frac;
+	}
+
+	/// @brief Adds height * residual to out[0..length), for a step sinceStep samples before out[0]
+	void addStep(float* out, float sinceStep, float height) const {
+		// same fraction for all samples, the table index advances by oversampling per sample
+		const float pos = std::clamp(sinceStep, 0.f, 1.f) * oversampling;
+		const int first = static_cast<int>(pos);
+		const float frac = pos - static_cast<float>(first);
+		for (int k = 0, idx = first; k < length && idx < length * oversampling; ++k, idx += oversampling) {
+			out[k] += height * (table[idx] + (table[idx + 1] - table[idx]) * frac);
+		}
+	}
+
+private:
+	MinBlep() {
+		constexpr int numTaps = length * oversampling;
+		constexpr size_t fftSize = 8 * numTaps; // zero padding against cepstral aliasing
+		std::vector<std::complex<float>> x(fftSize);
+		for (int i = 0; i <= numTaps; ++i) {
+			const double t = static_cast<double>(i - numTaps / 2) / oversampling;
+			const double sinc = t == 0. ? 1. : std::sin(M_PI * t) / (M_PI * t);
+			const double window = 0.42 - 0.5 * std::cos(2. * M_PI * i / numTaps) + 0.08 * std::cos(4. * M_PI * i / numTaps);
+			x[i] = static_cast<float>(sinc * window);
+		}
+
+		// real cepstrum, folded onto the positive quefrencies gives the minimum-phase spectrum
+		fft(x);
+		for (auto& value : x) {
+			value = std::log(std::max(std::abs(value), 1e-7f));
+		}
+		fft(x, true);
+		for (size_t i = 0; i < fftSize; ++i) {
+			const float fold = i == 0 || i == fftSize / 2 ? 1.f : i < fftSize / 2 ? 2.f : 0.f;
+			x[i] = x[i].real() * fold / static_cast<float>(fftSize);
+		}
+		fft(x);
+		for (auto& value : x) {
+			value = std::exp(value);
+		}
+		fft(x, true);
+
+		// integrated impulse is the step, the residual the difference to the naive step
+		double sum{};
+		for (int i = 0; i < numTaps; ++i) {
+			sum += x[i].real();
+		}
+		double step{};
+		for (int i = 0; i < numTaps; ++i) {
+			step += x[i].real();
+			table[i] = static_cast<float>(step / sum - 1.);
+		}
+		table[numTaps] = 0.f;
+	}
+
+	std::array<float, length * oversampling + 1> table{};
+};
+
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace Butterfly {
+
+/// @brief Glide of the morph position between frames, audio thread only.
+/// Within the current pair of frames the crossfade weight ramps straight to the target. Further away, three ramps are
+/// queued: to the current frame facing the target, a direct crossfade from there to the target pair's frame facing
+/// back (skipping the frames in between), and within the target pair to the target. Each ramp takes samplesPerFrame
+/// samples per frame of distance, the crossfade counts as one. A new target while gliding turns back or continues
+/// from where the glide is, without jumps.
+/// The ramps wait in a ring of fixed capacity, nothing allocates.
+class MorphGlide
+{
+public:
+	/// @param samplesPerFrame  ramp length for a distance of one frame, at least 1, applies to the next ramps
+	void setSamplesPerFrame(int samplesPerFrame) {
+		this->samplesPerFrame = std::max(samplesPerFrame, 1);
+	}
+
+	/// @brief Keeps the current pair of frames if it still exists, then glides to the last target position.
+	void setNumFrames(int numFrames) {
+		if (numFrames == this->numFrames) { return; }
+		this->numFrames = numFrames;
+		const int lastFirst = std::max(numFrames - 2, 0);
+		if (numFrames < 2 || first > lastFirst || second >= numFrames || first == second) {
+			first = std::min(first, lastFirst);
+			second = numFrames < 2 ? first : first + 1;
+			stop();
+		}
+		retarget();
+	}
+
+	/// @param position  morph position in [0, 1] across all frames, the same target again keeps the glide going.
+	/// NaN and infinity count as 0.
+	void setTarget(float position) {
+		position = clampPosition(position);
+		if (position == targetPosition) { return; }
+		targetPosition = position;
+		retarget();
+	}
+
+	/// @brief Jumps to position and glides from there to the target, e.g. where a morph signal left off.
+	void jumpTo(float position) {
+		if (numFrames < 2) { return; }
+		const float scaled = clampPosition(position) * static_cast<float>(numFrames - 1);
+		first = std::min(static_cast<int>(scaled), numFrames - 2);
+		second = first + 1;
+		weight = scaled - static_cast<float>(first);
+		stop();
+		retarget();
+	}
+
+	/// @brief Advances the glide by n samples. weights[i] is the crossfade weight of sample i between the two frames of
+	/// its run, 0: the first one. Calls f(firstTable, secondTable, begin, end) for each run of samples with the same frames.
+	template<class F>
+	void process(int n, float* weights, F&& f) {
+		int begin = 0;
+		while (begin < n) {
+			while (stepsLeft == 0 && numInstructions > 0) {
+				startNext();
+			}
+			const int end = stepsLeft > 0 ? std::min(n, begin + stepsLeft) : n;
+			const int count = end - begin;
+			for (int i = 0; i < count; ++i) {
+				weights[begin + i] = weight + step * static_cast<float>(i + 1);
+			}
+			if (stepsLeft > 0) {
+				stepsLeft -= count;
+				weight = stepsLeft == 0 ? targetWeight : weight + step * static_cast<float>(count);
+				if (stepsLeft == 0) { step = 0.f; }
+			}
+			f(first, second, begin, end);
+			begin = end;
+		}
+	}
+
+	bool isGliding() const { return stepsLeft > 0 || numInstructions > 0; }
+
+private:
+	static float clampPosition(float position) {
+		return std::isfinite(position) ? std::clamp(position, 0.f, 1.f) : 0.f;
+	}
+
+	struct RampingInstruction
+	{
+		int firstTable{};
+		int secondTable{};
+		float weight{};		// crossfade weight to ramp to
+	};
+
+	static constexpr int capacity = 4; // a glide takes three
+
+	// queues the ramps from where the glide is to targetPosition
+	void retarget() {
+		clearInstructions();
+		if (numFrames < 2) {
+			weight = 0.f;
+			stop();
+			return;
+		}
+		const float scaled = targetPosition * static_cast<float>(numFrames - 1);
+		const int newFirst = std::min(static_cast<int>(scaled), numFrames - 2);
+		const float fraction = scaled - static_cast<float>(newFirst);
+		const bool crossfading = second != first + 1; // the direct crossfade between non-adjacent frames
+
+		// from a crossfade away from first, turn back to first, a crossfade towards first just continues
+		if (crossfading && targetWeight == 1.f) { rampTo(0.f, weight); }
+		if (newFirst == first) {
+			if (crossfading) {
+				push({ first, first + 1, fraction });
+			} else {
+				rampTo(fraction, std::abs(weight - fraction));
+			}
+			return;
+		}
+		if (!crossfading) { stop(); }
+		if (newFirst > first) {
+			push({ first, first + 1, 1.f });
+			push({ newFirst, first + 1, 0.f });
+		} else {
+			push({ first, first + 1, 0.f });
+			push({ first, newFirst + 1, 1.f });
+		}
+		push({ newFirst, newFirst + 1, fraction });
+	}
+
+	void rampTo(float target, float distance) {
+		targetWeight = target;
+		stepsLeft = static_cast<int>(std::lround(static_cast<float>(samplesPerFrame) * distance));
+		if (stepsLeft == 0) {
+			weight = target;
+			step = 0.f;
+		} else {
+			step = (target - weight) / static_cast<float>(stepsLeft);
+		}
+	}
+
+	void stop() {
+		targetWeight = weight;
+		stepsLeft = 0;
+		step = 0.f;
+	}
+
+	void startNext() {
+		const auto instruction = instructions[head];
+		head = (head + 1) % capacity;
+		--numInstructions;
+		first = instruction.firstTable;
+		second = instruction.secondTable;
+		rampTo(instruction.weight, first != second ? std::abs(weight - instruction.weight) : 0.f);
+	}
+
+	void push(const RampingInstruction& instruction) {
+		instructions[(head + numInstructions) % capacity] = instruction;
+		++numInstructions;
+	}
+
+	void clearInstructions() {
+		head = numInstructions = 0;
+	}
+
+	std::array<RampingInstruction, capacity> instructions{};
+	int head{}, numInstructions{};
+
+	int numFrames{}, samplesPerFrame{ 1 };
+	int first{}, second{};				// second may not be first + 1 during the crossfade
+	float weight{}, targetWeight{}, step{};
+	int stepsLeft{};
+	float targetPosition{};
+};
+
+}
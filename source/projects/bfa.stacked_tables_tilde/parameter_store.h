@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace Butterfly {
+
+/// @brief Latest value of each parameter, handed from the UI thread to the audio thread.
+/// One atomic slot per parameter and a dirty bitmask: writes to the same parameter coalesce, so it can't
+/// overflow, and the reader only ever sees the most recent value of each changed parameter.
+/// Wait-free on both sides.
+template<size_t numSlots>
+class ParameterStore
+{
+	static_assert(numSlots <= 32, "one dirty bit per slot");
+
+public:
+	// UI thread
+	void set(size_t slot, double value) {
+		slots[slot].store(value, std::memory_order_relaxed);
+		dirty.fetch_or(uint32_t{ 1 } << slot, std::memory_order_release); // after the store: a reader that sees the bit sees the value
+	}
+
+	// Audio thread only! Calls f(slot, value) for every slot set since the last call, in slot order.
+	// A value set while consuming may be reported now and again next time, never lost.
+	template<class F>
+	void consume(F&& f) {
+		auto mask = dirty.exchange(0, std::memory_order_acquire);
+		for (size_t slot = 0; mask != 0; ++slot, mask >>= 1) {
+			if (mask & 1) { f(slot, slots[slot].load(std::memory_order_relaxed)); }
+		}
+	}
+
+private:
+	std::array<std::atomic<double>, numSlots> slots{};
+	std::atomic<uint32_t> dirty{};
+};
+
+}
@@ -0,0 +1,429 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Vectorized inner loops of the block renderer. Every kernel has an AVX2 path (gathers), an SSE2
+// path (scalar loads, vector arithmetic) and a plain scalar fallback (e.g. arm64).
+
+#if defined(__AVX2__)
+#define BFA_HAS_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BFA_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Butterfly {
+
+/// @brief A sample of a frequency signal as the oscillator plays it: NaN and infinity become 0, everything else is
+/// clamped to +-limit (the sample rate, i.e. at most one cycle per sample).
+inline float sanitizeFrequency(double frequency, float limit) {
+	const auto f = static_cast<float>(frequency);
+	return std::isfinite(f) ? std::clamp(f, -limit, limit) : 0.f;
+}
+
+/// @brief Phase accumulation for a frequency signal, i.e. one phase increment per sample.
+/// phases[i] is the phase before the increment of sample i, wrapped into [0, 1). Negative frequencies run backwards.
+/// The frequencies are sanitized as by sanitizeFrequency() with the sample rate as limit, so phase stays finite.
+/// @param phase  running phase, advanced by all n increments
+/// @return       the largest absolute frequency, for choosing a band that doesn't alias
+inline float accumulatePhases(const double* frequencies, float invSampleRate, double& phase, float* phases, int n) {
+	constexpr float maxPhase = 0.99999994f; // largest float below 1
+	const float limit = 1.f / invSampleRate;
+	const float start = static_cast<float>(phase);
+	float sum{}, maxFrequency{};
+	int i = 0;
+#if defined(BFA_HAS_SSE2)
+	const __m128 invSampleRateV = _mm_set1_ps(invSampleRate);
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 maxPhaseV = _mm_set1_ps(maxPhase);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 infinity = _mm_set1_ps(INFINITY);
+	const __m128 limitV = _mm_set1_ps(limit);
+	const __m128 minusLimitV = _mm_set1_ps(-limit);
+	__m128 carry = _mm_set1_ps(start);
+	__m128 maxV = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 f = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(frequencies + i)), _mm_cvtpd_ps(_mm_loadu_pd(frequencies + i + 2)));
+		// |f| < infinity is false for NaN and infinity
+		f = _mm_and_ps(f, _mm_cmplt_ps(_mm_and_ps(f, absMask), infinity));
+		f = _mm_min_ps(_mm_max_ps(f, minusLimitV), limitV);
+		maxV = _mm_max_ps(maxV, _mm_and_ps(f, absMask));
+		// inclusive prefix sum of the increments in two shift-and-add steps
+		const __m128 inc = _mm_mul_ps(f, invSampleRateV);
+		__m128 scan = _mm_add_ps(inc, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(inc), 4)));
+		scan = _mm_add_ps(scan, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(scan), 8)));
+		__m128 p = _mm_add_ps(carry, _mm_sub_ps(scan, inc));
+		// p - floor(p)
+		__m128 floored = _mm_cvtepi32_ps(_mm_cvttps_epi32(p));
+		floored = _mm_sub_ps(floored, _mm_and_ps(_mm_cmpgt_ps(floored, p), one));
+		_mm_storeu_ps(phases + i, _mm_min_ps(_mm_sub_ps(p, floored), maxPhaseV));
+		carry = _mm_add_ps(carry, _mm_shuffle_ps(scan, scan, _MM_SHUFFLE(3, 3, 3, 3)));
+	}
+	sum = _mm_cvtss_f32(carry) - start;
+	alignas(16) float lanes[4];
+	_mm_store_ps(lanes, maxV);
+	maxFrequency = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+	for (; i < n; ++i) {
+		const float p = start + sum;
+		phases[i] = std::min(p - std::floor(p), maxPhase);
+		const float f = sanitizeFrequency(frequencies[i], limit);
+		sum += f * invSampleRate;
+		maxFrequency = std::max(maxFrequency, std::abs(f));
+	}
+	phase += static_cast<double>(sum);
+	phase -= std::floor(phase);
+	return maxFrequency;
+}
+
+/// @brief Morph weights from a morph signal: out[i] = clamp(in[i], 0, 1) * scale, NaN and infinity count as 0.
+/// @param in     per-sample morph positions, double as delivered by the host
+/// @param scale  number of frames - 1, so the integer part of a weight selects the first frame of the pair
+inline void scaleMorphSignal(const double* in, float scale, float* out, int n) {
+	int i = 0;
+#if defined(BFA_HAS_AVX2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 scaleV = _mm_set1_ps(scale);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 infinity = _mm_set1_ps(INFINITY);
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm256_cvtpd_ps(_mm256_loadu_pd(in + i));
+		v = _mm_and_ps(v, _mm_cmplt_ps(_mm_and_ps(v, absMask), infinity));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scaleV));
+	}
+#elif defined(BFA_HAS_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 scaleV = _mm_set1_ps(scale);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 infinity = _mm_set1_ps(INFINITY);
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(in + i)), _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2)));
+		v = _mm_and_ps(v, _mm_cmplt_ps(_mm_and_ps(v, absMask), infinity));
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scaleV));
+	}
+#endif
+	for (; i < n; ++i) {
+		const float v = static_cast<float>(in[i]);
+		out[i] = (std::isfinite(v) ? std::clamp(v, 0.f, 1.f) : 0.f) * scale;
+	}
+}
+
+/// @brief Index of the first upward zero crossing, i.e. signal[i - 1] <= 0 < signal[i].
+/// @param previous  the sample before signal[0]
+/// @return          n if there is none
+inline int findUpwardCrossing(const double* signal, double previous, int n) {
+	if (n == 0) { return 0; }
+	if (previous <= 0. && signal[0] > 0.) { return 0; }
+	int i = 1;
+#if defined(BFA_HAS_AVX2)
+	const __m256d zero = _mm256_setzero_pd();
+	for (; i + 4 <= n; i += 4) {
+		const __m256d before = _mm256_cmp_pd(_mm256_loadu_pd(signal + i - 1), zero, _CMP_LE_OQ);
+		const __m256d after = _mm256_cmp_pd(_mm256_loadu_pd(signal + i), zero, _CMP_GT_OQ);
+		if (const int mask = _mm256_movemask_pd(_mm256_and_pd(before, after)); mask != 0) {
+			return i + (mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3);
+		}
+	}
+#elif defined(BFA_HAS_SSE2)
+	const __m128d zero = _mm_setzero_pd();
+	for (; i + 2 <= n; i += 2) {
+		const __m128d before = _mm_cmple_pd(_mm_loadu_pd(signal + i - 1), zero);
+		const __m128d after = _mm_cmpgt_pd(_mm_loadu_pd(signal + i), zero);
+		if (const int mask = _mm_movemask_pd(_mm_and_pd(before, after)); mask != 0) {
+			return i + (mask & 1 ? 0 : 1);
+		}
+	}
+#endif
+	for (; i < n; ++i) {
+		if (signal[i - 1] <= 0. && signal[i] > 0.) { return i; }
+	}
+	return n;
+}
+
+/// @brief phases[i] += shift, wrapped into [0, 1).
+/// @param shift  in (-1, 1)
+inline void shiftPhases(float* phases, float shift, int n) {
+	constexpr float maxPhase = 0.99999994f; // largest float below 1
+	int i = 0;
+#if defined(BFA_HAS_AVX2)
+	const __m256 shiftV = _mm256_set1_ps(shift);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.f);
+	const __m256 maxPhaseV = _mm256_set1_ps(maxPhase);
+	for (; i + 8 <= n; i += 8) {
+		__m256 p = _mm256_add_ps(_mm256_loadu_ps(phases + i), shiftV);
+		p = _mm256_add_ps(p, _mm256_and_ps(_mm256_cmp_ps(p, zero, _CMP_LT_OQ), one));
+		p = _mm256_sub_ps(p, _mm256_and_ps(_mm256_cmp_ps(p, one, _CMP_GE_OQ), one));
+		_mm256_storeu_ps(phases + i, _mm256_min_ps(p, maxPhaseV));
+	}
+#elif defined(BFA_HAS_SSE2)
+	const __m128 shiftV = _mm_set1_ps(shift);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 maxPhaseV = _mm_set1_ps(maxPhase);
+	for (; i + 4 <= n; i += 4) {
+		__m128 p = _mm_add_ps(_mm_loadu_ps(phases + i), shiftV);
+		p = _mm_add_ps(p, _mm_and_ps(_mm_cmplt_ps(p, zero), one));
+		p = _mm_sub_ps(p, _mm_and_ps(_mm_cmpge_ps(p, one), one));
+		_mm_storeu_ps(phases + i, _mm_min_ps(p, maxPhaseV));
+	}
+#endif
+	for (; i < n; ++i) {
+		float p = phases[i] + shift;
+		p += p < 0.f ? 1.f : 0.f;
+		p -= p >= 1.f ? 1.f : 0.f;
+		phases[i] = std::min(p, maxPhase);
+	}
+}
+
+/// @brief Linear interpolation of two tables of equal size followed by a crossfade.
+/// out[i] = lerp(gainA * a(phases[i]), gainB * b(phases[i]), morph[i]), where a and b are read at phases[i] * size.
+/// @param tableA, tableB   size samples plus one wrap-around guard sample each
+/// @param phases           normalized phases in [0, 1)
+/// @param morph            crossfade weights, 0 = tableA, 1 = tableB
+/// @param gainA, gainB     per-frame gain and polarity
+inline void interpolateAndCrossfade(const float* tableA, const float* tableB, int size, const float* phases, const float* morph, float* out, int n,
+	float gainA = 1.f, float gainB = 1.f) {
+	const float fsize = static_cast<float>(size);
+	int i = 0;
+#if defined(BFA_HAS_AVX2)
+	const __m256 sizeV = _mm256_set1_ps(fsize);
+	const __m256 gainAV = _mm256_set1_ps(gainA);
+	const __m256 gainBV = _mm256_set1_ps(gainB);
+	const __m256i one = _mm256_set1_epi32(1);
+	for (; i + 8 <= n; i += 8) {
+		const __m256 pos = _mm256_mul_ps(_mm256_loadu_ps(phases + i), sizeV);
+		const __m256i i0 = _mm256_cvttps_epi32(pos);
+		const __m256i i1 = _mm256_add_epi32(i0, one);
+		const __m256 frac = _mm256_sub_ps(pos, _mm256_cvtepi32_ps(i0));
+		const __m256 a0 = _mm256_i32gather_ps(tableA, i0, 4);
+		const __m256 a1 = _mm256_i32gather_ps(tableA, i1, 4);
+		const __m256 b0 = _mm256_i32gather_ps(tableB, i0, 4);
+		const __m256 b1 = _mm256_i32gather_ps(tableB, i1, 4);
+		const __m256 a = _mm256_mul_ps(gainAV, _mm256_add_ps(a0, _mm256_mul_ps(frac, _mm256_sub_ps(a1, a0))));
+		const __m256 b = _mm256_mul_ps(gainBV, _mm256_add_ps(b0, _mm256_mul_ps(frac, _mm256_sub_ps(b1, b0))));
+		_mm256_storeu_ps(out + i, _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(morph + i), _mm256_sub_ps(b, a))));
+	}
+#elif defined(BFA_HAS_SSE2)
+	const __m128 sizeV = _mm_set1_ps(fsize);
+	const __m128 gainAV = _mm_set1_ps(gainA);
+	const __m128 gainBV = _mm_set1_ps(gainB);
+	alignas(16) int32_t idx[4];
+	for (; i + 4 <= n; i += 4) {
+		const __m128 pos = _mm_mul_ps(_mm_loadu_ps(phases + i), sizeV);
+		const __m128i i0 = _mm_cvttps_epi32(pos);
+		const __m128 frac = _mm_sub_ps(pos, _mm_cvtepi32_ps(i0));
+		_mm_store_si128(reinterpret_cast<__m128i*>(idx), i0);
+		const __m128 a0 = _mm_setr_ps(tableA[idx[0]], tableA[idx[1]], tableA[idx[2]], tableA[idx[3]]);
+		const __m128 a1 = _mm_setr_ps(tableA[idx[0] + 1], tableA[idx[1] + 1], tableA[idx[2] + 1], tableA[idx[3] + 1]);
+		const __m128 b0 = _mm_setr_ps(tableB[idx[0]], tableB[idx[1]], tableB[idx[2]], tableB[idx[3]]);
+		const __m128 b1 = _mm_setr_ps(tableB[idx[0] + 1], tableB[idx[1] + 1], tableB[idx[2] + 1], tableB[idx[3] + 1]);
+		const __m128 a = _mm_mul_ps(gainAV, _mm_add_ps(a0, _mm_mul_ps(frac, _mm_sub_ps(a1, a0))));
+		const __m128 b = _mm_mul_ps(gainBV, _mm_add_ps(b0, _mm_mul_ps(frac, _mm_sub_ps(b1, b0))));
+		_mm_storeu_ps(out + i, _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(morph + i), _mm_sub_ps(b, a))));
+	}
+#endif
+	for (; i < n; ++i) {
+		const float pos = phases[i] * fsize;
+		const int i0 = static_cast<int>(pos);
+		const float frac = pos - static_cast<float>(i0);
+		const float a = gainA * (tableA[i0] + frac * (tableA[i0 + 1] - tableA[i0]));
+		const float b = gainB * (tableB[i0] + frac * (tableB[i0 + 1] - tableB[i0]));
+		out[i] = a + morph[i] * (b - a);
+	}
+}
+
+namespace detail {
+
+inline constexpr int laneBufferSize = 64; // samples whose lane sums are reduced at once
+
+#if defined(BFA_HAS_AVX2)
+// out[i] += sum of the 8 lanes of sums[i], a transposing reduction of 8 samples at a time
+inline void addLaneSums(const __m256* sums, float* out, int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256 s01 = _mm256_hadd_ps(sums[i], sums[i + 1]);
+		const __m256 s23 = _mm256_hadd_ps(sums[i + 2], sums[i + 3]);
+		const __m256 s45 = _mm256_hadd_ps(sums[i + 4], sums[i + 5]);
+		const __m256 s67 = _mm256_hadd_ps(sums[i + 6], sums[i + 7]);
+		// low halves of samples 0-3 in the low 128 bits, their high halves in the high 128 bits, same for 4-7
+		const __m256 s0123 = _mm256_hadd_ps(s01, s23);
+		const __m256 s4567 = _mm256_hadd_ps(s45, s67);
+		const __m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(s0123, s4567, 0x20), _mm256_permute2f128_ps(s0123, s4567, 0x31));
+		_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), sum));
+	}
+	for (; i < n; ++i) {
+		__m128 sum = _mm_add_ps(_mm256_castps256_ps128(sums[i]), _mm256_extractf128_ps(sums[i], 1));
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		out[i] += _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1))));
+	}
+}
+#endif
+
+#if defined(BFA_HAS_SSE2)
+// out[i] += sum of the 4 lanes of sums[i], a transposing reduction of 4 samples at a time
+inline void addLaneSums(const __m128* sums, float* out, int n) {
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 s0 = sums[i], s1 = sums[i + 1], s2 = sums[i + 2], s3 = sums[i + 3];
+		_MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+		_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3))));
+	}
+	for (; i < n; ++i) {
+		const __m128 sum = _mm_add_ps(sums[i], _mm_movehl_ps(sums[i], sums[i]));
+		out[i] += _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1))));
+	}
+}
+#endif
+
+}
+
+/// @brief Renders voices, one voice per SIMD lane, and adds their sum to outLeft and outRight.
+/// Every lane reads its own band of the two frames: tablesA + offsetsA[lane] and tablesB + offsetsB[lane], sizes[lane]
+/// samples each. The offsets are relative to a table of the same FrameTables slab, so voices in different bands still
+/// share one gather. Each voice has its own phase, increment, level and panning.
+/// The lanes are summed into per-sample vectors first and reduced to the output once per laneBufferSize samples.
+/// @param morph               per sample crossfade weights of all voices, nullptr: laneMorphs
+/// @param laneMorphs          per voice constant crossfade weights, only read without morph
+/// @param phases, levels      per voice, advanced by n samples
+/// @param incrementScales     per sample factor on all increments, e.g. from a frequency signal, nullptr: 1. Negative
+///                            increments run backwards, the magnitude has to stay below 1.
+/// @param levelSteps          per voice level change per sample
+/// @param pansLeft, pansRight per voice gain of the left and right channel
+inline void renderVoiceLanes(const float* tablesA, const float* tablesB, const int32_t* offsetsA, const int32_t* offsetsB, const int32_t* sizes,
+	const float* morph, const float* laneMorphs, float gainA, float gainB,
+	float* phases, const float* increments, const float* incrementScales, float* levels, const float* levelSteps, const float* pansLeft, const float* pansRight, int numLanes,
+	float* outLeft, float* outRight, int n) {
+	int lane = 0;
+#if defined(BFA_HAS_AVX2)
+	if (numLanes >= 8) {
+		const int endLane = numLanes - numLanes % 8;
+		__m256 sumsLeft[detail::laneBufferSize], sumsRight[detail::laneBufferSize];
+		const __m256 one = _mm256_set1_ps(1.f);
+		const __m256i oneI = _mm256_set1_epi32(1);
+		for (int begin = 0; begin < n; begin += detail::laneBufferSize) {
+			const int count = std::min(n - begin, detail::laneBufferSize);
+			std::fill_n(sumsLeft, count, _mm256_setzero_ps());
+			std::fill_n(sumsRight, count, _mm256_setzero_ps());
+			for (lane = 0; lane < endLane; lane += 8) {
+				const __m256i offsetA = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsetsA + lane));
+				const __m256i offsetB = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(offsetsB + lane));
+				const __m256 sizeV = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sizes + lane)));
+				const __m256 inc = _mm256_loadu_ps(increments + lane);
+				const __m256 step = _mm256_loadu_ps(levelSteps + lane);
+				const __m256 panLeft = _mm256_loadu_ps(pansLeft + lane);
+				const __m256 panRight = _mm256_loadu_ps(pansRight + lane);
+				__m256 phase = _mm256_loadu_ps(phases + lane);
+				__m256 level = _mm256_loadu_ps(levels + lane);
+				const __m256 laneMorph = morph ? _mm256_setzero_ps() : _mm256_loadu_ps(laneMorphs + lane);
+				for (int i = 0; i < count; ++i) {
+					const __m256 pos = _mm256_mul_ps(phase, sizeV);
+					const __m256i i0 = _mm256_cvttps_epi32(pos);
+					const __m256 frac = _mm256_sub_ps(pos, _mm256_cvtepi32_ps(i0));
+					const __m256i ia = _mm256_add_epi32(i0, offsetA);
+					const __m256i ib = _mm256_add_epi32(i0, offsetB);
+					const __m256 a0 = _mm256_i32gather_ps(tablesA, ia, 4);
+					const __m256 a1 = _mm256_i32gather_ps(tablesA, _mm256_add_epi32(ia, oneI), 4);
+					const __m256 b0 = _mm256_i32gather_ps(tablesB, ib, 4);
+					const __m256 b1 = _mm256_i32gather_ps(tablesB, _mm256_add_epi32(ib, oneI), 4);
+					const __m256 a = _mm256_mul_ps(_mm256_set1_ps(gainA), _mm256_add_ps(a0, _mm256_mul_ps(frac, _mm256_sub_ps(a1, a0))));
+					const __m256 b = _mm256_mul_ps(_mm256_set1_ps(gainB), _mm256_add_ps(b0, _mm256_mul_ps(frac, _mm256_sub_ps(b1, b0))));
+					const __m256 x = _mm256_mul_ps(level, _mm256_add_ps(a, _mm256_mul_ps(morph ? _mm256_set1_ps(morph[begin + i]) : laneMorph, _mm256_sub_ps(b, a))));
+					sumsLeft[i] = _mm256_add_ps(sumsLeft[i], _mm256_mul_ps(x, panLeft));
+					sumsRight[i] = _mm256_add_ps(sumsRight[i], _mm256_mul_ps(x, panRight));
+					phase = _mm256_add_ps(phase, incrementScales ? _mm256_mul_ps(inc, _mm256_set1_ps(incrementScales[begin + i])) : inc);
+					phase = _mm256_sub_ps(phase, _mm256_and_ps(_mm256_cmp_ps(phase, one, _CMP_GE_OQ), one));
+					phase = _mm256_add_ps(phase, _mm256_and_ps(_mm256_cmp_ps(phase, _mm256_setzero_ps(), _CMP_LT_OQ), one));
+					level = _mm256_add_ps(level, step);
+				}
+				_mm256_storeu_ps(phases + lane, phase);
+				_mm256_storeu_ps(levels + lane, level);
+			}
+			detail::addLaneSums(sumsLeft, outLeft + begin, count);
+			detail::addLaneSums(sumsRight, outRight + begin, count);
+		}
+		lane = endLane;
+	}
+#endif
+#if defined(BFA_HAS_SSE2)
+	if (numLanes - lane >= 4) {
+		const int firstLane = lane;
+		const int endLane = numLanes - (numLanes - lane) % 4;
+		__m128 sumsLeft[detail::laneBufferSize], sumsRight[detail::laneBufferSize];
+		alignas(16) int32_t idx[4];
+		const __m128 one = _mm_set1_ps(1.f);
+		for (int begin = 0; begin < n; begin += detail::laneBufferSize) {
+			const int count = std::min(n - begin, detail::laneBufferSize);
+			std::fill_n(sumsLeft, count, _mm_setzero_ps());
+			std::fill_n(sumsRight, count, _mm_setzero_ps());
+			for (lane = firstLane; lane < endLane; lane += 4) {
+				const float* tableA[4]{ tablesA + offsetsA[lane], tablesA + offsetsA[lane + 1], tablesA + offsetsA[lane + 2], tablesA + offsetsA[lane + 3] };
+				const float* tableB[4]{ tablesB + offsetsB[lane], tablesB + offsetsB[lane + 1], tablesB + offsetsB[lane + 2], tablesB + offsetsB[lane + 3] };
+				const __m128 sizeV = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sizes + lane)));
+				const __m128 inc = _mm_loadu_ps(increments + lane);
+				const __m128 step = _mm_loadu_ps(levelSteps + lane);
+				const __m128 panLeft = _mm_loadu_ps(pansLeft + lane);
+				const __m128 panRight = _mm_loadu_ps(pansRight + lane);
+				__m128 phase = _mm_loadu_ps(phases + lane);
+				__m128 level = _mm_loadu_ps(levels + lane);
+				const __m128 laneMorph = morph ? _mm_setzero_ps() : _mm_loadu_ps(laneMorphs + lane);
+				for (int i = 0; i < count; ++i) {
+					const __m128 pos = _mm_mul_ps(phase, sizeV);
+					const __m128i i0 = _mm_cvttps_epi32(pos);
+					const __m128 frac = _mm_sub_ps(pos, _mm_cvtepi32_ps(i0));
+					_mm_store_si128(reinterpret_cast<__m128i*>(idx), i0);
+					const __m128 a0 = _mm_setr_ps(tableA[0][idx[0]], tableA[1][idx[1]], tableA[2][idx[2]], tableA[3][idx[3]]);
+					const __m128 a1 = _mm_setr_ps(tableA[0][idx[0] + 1], tableA[1][idx[1] + 1], tableA[2][idx[2] + 1], tableA[3][idx[3] + 1]);
+					const __m128 b0 = _mm_setr_ps(tableB[0][idx[0]], tableB[1][idx[1]], tableB[2][idx[2]], tableB[3][idx[3]]);
+					const __m128 b1 = _mm_setr_ps(tableB[0][idx[0] + 1], tableB[1][idx[1] + 1], tableB[2][idx[2] + 1], tableB[3][idx[3] + 1]);
+					const __m128 a = _mm_mul_ps(_mm_set1_ps(gainA), _mm_add_ps(a0, _mm_mul_ps(frac, _mm_sub_ps(a1, a0))));
+					const __m128 b = _mm_mul_ps(_mm_set1_ps(gainB), _mm_add_ps(b0, _mm_mul_ps(frac, _mm_sub_ps(b1, b0))));
+					const __m128 x = _mm_mul_ps(level, _mm_add_ps(a, _mm_mul_ps(morph ? _mm_set1_ps(morph[begin + i]) : laneMorph, _mm_sub_ps(b, a))));
+					sumsLeft[i] = _mm_add_ps(sumsLeft[i], _mm_mul_ps(x, panLeft));
+					sumsRight[i] = _mm_add_ps(sumsRight[i], _mm_mul_ps(x, panRight));
+					phase = _mm_add_ps(phase, incrementScales ? _mm_mul_ps(inc, _mm_set1_ps(incrementScales[begin + i])) : inc);
+					phase = _mm_sub_ps(phase, _mm_and_ps(_mm_cmpge_ps(phase, one), one));
+					phase = _mm_add_ps(phase, _mm_and_ps(_mm_cmplt_ps(phase, _mm_setzero_ps()), one));
+					level = _mm_add_ps(level, step);
+				}
+				_mm_storeu_ps(phases + lane, phase);
+				_mm_storeu_ps(levels + lane, level);
+			}
+			detail::addLaneSums(sumsLeft, outLeft + begin, count);
+			detail::addLaneSums(sumsRight, outRight + begin, count);
+		}
+		lane = endLane;
+	}
+#endif
+	for (; lane < numLanes; ++lane) {
+		const float* tableA = tablesA + offsetsA[lane];
+		const float* tableB = tablesB + offsetsB[lane];
+		const float fsize = static_cast<float>(sizes[lane]);
+		float phase = phases[lane], level = levels[lane];
+		for (int i = 0; i < n; ++i) {
+			const float pos = phase * fsize;
+			const int i0 = static_cast<int>(pos);
+			const float frac = pos - static_cast<float>(i0);
+			const float a = gainA * (tableA[i0] + frac * (tableA[i0 + 1] - tableA[i0]));
+			const float b = gainB * (tableB[i0] + frac * (tableB[i0 + 1] - tableB[i0]));
+			const float x = level * (a + (morph ? morph[i] : laneMorphs[lane]) * (b - a));
+			outLeft[i] += x * pansLeft[lane];
+			outRight[i] += x * pansRight[lane];
+			phase += incrementScales ? increments[lane] * incrementScales[i] : increments[lane];
+			if (phase >= 1.f) { phase -= 1.f; }
+			if (phase < 0.f) { phase += 1.f; }
+			level += levelSteps[lane];
+		}
+		phases[lane] = phase;
+		levels[lane] = level;
+	}
+}
+
+}
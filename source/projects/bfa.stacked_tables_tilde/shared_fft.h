@@ -0,0 +1,42 @@
+#pragma once
+
+#include <complex>
+#include <span>
+#include <stdexcept>
+#include "antialiase.h"
+
+namespace Butterfly {
+
+/// @brief FFTCalculator for one table size, shared by all instances.
+/// Built on first use (thread-safe static initialization) and only read afterwards, so instantiating an object
+/// doesn't rebuild the twiddle tables.
+template<int tablesize>
+const Butterfly::FFTCalculator<float, tablesize>& sharedFFTCalculator() {
+	static const Butterfly::FFTCalculator<float, tablesize> fftCalculator;
+	return fftCalculator;
+}
+
+/// @brief In-place FFT with the shared FFTCalculator for data.size(), a power of two from 64 to 8192.
+/// The inverse transform is not scaled, it runs the forward transform on the complex conjugate.
+inline void fft(std::span<std::complex<float>> data, bool inverse = false) {
+	auto conjugate = [&data] {
+		for (auto& value : data) {
+			value = std::conj(value);
+		}
+	};
+	if (inverse) { conjugate(); }
+	switch (data.size()) {
+	case 64: sharedFFTCalculator<64>().fft(data); break;
+	case 128: sharedFFTCalculator<128>().fft(data); break;
+	case 256: sharedFFTCalculator<256>().fft(data); break;
+	case 512: sharedFFTCalculator<512>().fft(data); break;
+	case 1024: sharedFFTCalculator<1024>().fft(data); break;
+	case 2048: sharedFFTCalculator<2048>().fft(data); break;
+	case 4096: sharedFFTCalculator<4096>().fft(data); break;
+	case 8192: sharedFFTCalculator<8192>().fft(data); break;
+	default: throw std::invalid_argument("Unsupported FFT size");
+	}
+	if (inverse) { conjugate(); }
+}
+
+}
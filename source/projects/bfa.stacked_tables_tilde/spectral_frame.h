@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <complex>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "shared_fft.h"
+
+namespace Butterfly {
+
+/// @brief Compact storage of a single-cycle frame as its harmonic spectrum.
+/// Band-limited tables of any length are synthesized from it, see synthesizeMultitable().
+class SpectralFrame
+{
+public:
+	/// @param samples  one period, size must be a power of two
+	explicit SpectralFrame(std::span<const float> samples) : tablesize(static_cast<int>(samples.size())) {
+		std::vector<std::complex<float>> spectrum(samples.begin(), samples.end());
+		fft(spectrum);
+		// DC and the harmonics below Nyquist, scaled so the inverse transform restores the amplitude
+		harmonics.assign(spectrum.begin(), spectrum.begin() + tablesize / 2);
+		for (auto& harmonic : harmonics) {
+			harmonic /= static_cast<float>(tablesize);
+		}
+	}
+
+	SpectralFrame(const SpectralFrame&) = delete;
+	SpectralFrame& operator=(const SpectralFrame&) = delete;
+
+	/// Unique for the lifetime of the process, unlike the address
+	uint64_t getId() const { return id; }
+	int getTablesize() const { return tablesize; }
+	size_t sizeInBytes() const { return harmonics.size() * sizeof(std::complex<float>); }
+
+	/// sizeInBytes() of a frame of tablesize samples, without creating it
+	static size_t requiredBytes(int tablesize) { return static_cast<size_t>(tablesize / 2) * sizeof(std::complex<float>); }
+
+	/// @brief Writes one period with size samples containing DC and the first numHarmonics harmonics.
+	/// @param size  power of two, harmonics at or above size / 2 are dropped
+	void synthesize(float* out, int size, int numHarmonics) const {
+		const auto last = std::min({ numHarmonics, size / 2 - 1, static_cast<int>(harmonics.size()) - 1 });
+		std::vector<std::complex<float>> spectrum(size);
+		spectrum[0] = harmonics[0];
+		for (int k = 1; k <= last; ++k) {
+			spectrum[k] = harmonics[k];
+			spectrum[size - k] = std::conj(harmonics[k]);
+		}
+		fft(spectrum, true);
+		for (int i = 0; i < size; ++i) {
+			out[i] = spectrum[i].real();
+		}
+	}
+
+private:
+	static uint64_t nextId() {
+		static std::atomic<uint64_t> counter{};
+		return ++counter;
+	}
+
+	const uint64_t id{ nextId() };
+	int tablesize{};
+	std::vector<std::complex<float>> harmonics;
+};
+
+}
@@ -1,22 +1,60 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
 #include "item_collection.h"
 #include "antialiase.h"
 #include "wavetable.h"
-#include "wavetable_oscillator.h"
+#include "waveform_processing.h"
 #include "release_pool.h"
 #include "audio_processor.h"
+#include "thread_pool.h"
+#include "spectral_frame.h"
+#include "shared_fft.h"
+#include "frame_cache.h"
+#include "band_cache.h"
+#include "async_frame_builder.h"
+#include "../shared/periodic_resampler.h"
 
 inline constexpr float minusOneDb = 0.891251; //-1dB
+inline constexpr size_t defaultMemoryBudget = 32 << 20; // bytes
+inline constexpr size_t defaultBandCacheSize = 4 << 20; // bytes, spectral bands no frame holds
 
 namespace Butterfly {
 
+inline constexpr std::array<int, 6> supportedTablesizes{ 256, 512, 1024, 2048, 4096, 8192 };
+
+inline bool isSupportedTablesize(int tablesize) {
+	return std::find(supportedTablesizes.begin(), supportedTablesizes.end(), tablesize) != supportedTablesizes.end();
+}
+
+enum class StorageMode {
+	tables,		// all bands rendered when the frame is created
+	spectral	// harmonic spectrum, bands are synthesized on demand for the frequencies the oscillator plays
+};
+
 struct Frame
 {
-	using Wavetable = Butterfly::Wavetable<float>;
+	std::vector<float> samples;							// raw data
+	std::shared_ptr<const FrameTables> multitable;		// antialiased data, immutable and shared with published states
+	std::shared_ptr<const SpectralFrame> spectrum;		// spectral storage only
+	float spectralSampleRate{};							// spectral storage: sample rate the tables were synthesized at
+	float peak{};										// of the raw data
+	float gain{ 1.f };									// gain and polarity, samples and tables are never scaled
+};
+
+using AsyncFrameBuilder = AsyncBuilder<Frame>;
 
-	std::vector<float> samples;		   // raw data
-	std::vector<Wavetable> multitable; // antialiased data
+// Bands synthesized for spectral frames in the background, see StackedFrames::requestSpectralBands()
+struct SpectralBands
+{
+	std::pair<size_t, size_t> bands;	// [first, last]
+	float sampleRate{};
+	std::vector<std::pair<uint64_t, std::shared_ptr<const FrameTables>>> tables;	// by SpectralFrame::getId()
 };
 
 /// @brief …
@@ -30,15 +68,122 @@ std::pair<int, double> computeMorphingStuff(float normalizedMorphingPos, int num
 	return { targetFirstTable, targetFractionalMorphingParam };
 }
 
+// Band-limits a frame into all bands
+// Higher bands are stored with fewer samples (see mipTablesize()). The layout only depends on splitFreqs,
+// so all frames share it and the oscillator can crossfade band by band.
+// The bands are independent, so they are band-limited in chunks on the shared thread pool. Every chunk
+// runs its own Antialiaser, the FFTCalculator is only read and can be shared.
+template<int internalTablesize>
+std::shared_ptr<FrameTables> antialiaseFrame(const std::vector<float>& data, float sampleRate, const std::vector<float>& splitFreqs,
+	const Butterfly::FFTCalculator<float, internalTablesize>& fftCalculator) {
+	const size_t numBands = splitFreqs.size();
+	auto& pool = sharedThreadPool();
+	const size_t numChunks = std::min(numBands, pool.numWorkers() + 1);
+	std::vector<int> bandSizes(numBands);
+	std::transform(splitFreqs.begin(), splitFreqs.end(), bandSizes.begin(), [&](float splitFreq) {
+		return mipTablesize(internalTablesize, splitFreqs.back(), splitFreq);
+	});
+	auto multitable = std::make_shared<FrameTables>(bandSizes);
+	pool.parallelFor(numChunks, [&](size_t chunk) {
+		const auto begin = numBands * chunk / numChunks;
+		const auto end = numBands * (chunk + 1) / numChunks;
+		std::vector<Wavetable<float>> bands(end - begin);
+		Butterfly::Antialiaser antialiaser{ sampleRate, fftCalculator };
+		antialiaser.antialiase(data.begin(), splitFreqs.begin() + begin, splitFreqs.begin() + end, bands);
+		for (size_t i = begin; i < end; ++i) {
+			multitable->setBand(i, bands[i - begin]);
+		}
+	});
+	return multitable;
+}
+
 // Frame factory function
+// Identical frames of all instances are band-limited once and shared (see g_frameCache).
 template<int internalTablesize>
 Frame createFrame(const std::vector<float>& data, float sampleRate, const std::vector<float>& splitFreqs,
 	const Butterfly::FFTCalculator<float, internalTablesize>& fftCalculator) {
 	Frame frame;
 	frame.samples = data;
-	frame.multitable.resize(splitFreqs.size());
-	Butterfly::Antialiaser antialiaser{ sampleRate, fftCalculator };
-	antialiaser.antialiase(data.begin(), splitFreqs.begin(), splitFreqs.end(), frame.multitable);
+	frame.peak = Butterfly::peak(data.begin(), data.end());
+	frame.multitable = g_frameCache.getOrBuild({ data, sampleRate, splitFreqs }, [&]() -> std::shared_ptr<const FrameTables> {
+		return antialiaseFrame(data, sampleRate, splitFreqs, fftCalculator);
+	});
+	return frame;
+}
+
+// Dispatches to the createFrame() instantiation for data.size(), which has to be one of supportedTablesizes
+inline Frame createFrame(const std::vector<float>& data, float sampleRate, const std::vector<float>& splitFreqs) {
+	switch (data.size()) {
+	case 256: return createFrame(data, sampleRate, splitFreqs, sharedFFTCalculator<256>());
+	case 512: return createFrame(data, sampleRate, splitFreqs, sharedFFTCalculator<512>());
+	case 1024: return createFrame(data, sampleRate, splitFreqs, sharedFFTCalculator<1024>());
+	case 2048: return createFrame(data, sampleRate, splitFreqs, sharedFFTCalculator<2048>());
+	case 4096: return createFrame(data, sampleRate, splitFreqs, sharedFFTCalculator<4096>());
+	case 8192: return createFrame(data, sampleRate, splitFreqs, sharedFFTCalculator<8192>());
+	default: throw std::invalid_argument("Unsupported table size");
+	}
+}
+
+// Band-limited resampling of one period, the size of samples has to be a power of two
+inline std::vector<float> resamplePeriod(const std::vector<float>& samples, int newSize) {
+	const SpectralFrame spectrum{ samples };
+	std::vector<float> resampled(newSize);
+	spectrum.synthesize(resampled.data(), newSize, newSize / 2 - 1);
+	return resampled;
+}
+
+// Spectral frame factory function, a single FFT. The bands are synthesized when the frame is added to StackedFrames.
+inline Frame createSpectralFrame(const std::vector<float>& data) {
+	Frame frame;
+	frame.samples = data;
+	frame.peak = Butterfly::peak(data.begin(), data.end());
+	frame.spectrum = std::make_shared<SpectralFrame>(frame.samples);
+	return frame;
+}
+
+// Bands the oscillator selects for frequencies in [lowestFreq, highestFreq]
+inline std::pair<size_t, size_t> calculateBandRange(const std::vector<float>& splitFreqs, float lowestFreq, float highestFreq) {
+	auto bandFor = [&splitFreqs](float freq) {
+		const auto it = std::lower_bound(splitFreqs.begin(), splitFreqs.end(), freq);
+		return std::min(static_cast<size_t>(std::distance(splitFreqs.begin(), it)), splitFreqs.size() - 1);
+	};
+	return { bandFor(lowestFreq), bandFor(highestFreq) };
+}
+
+// Band-limits a spectral frame into the bands [bandRange.first, bandRange.second] with the same layout as createFrame().
+// The bands are synthesized straight into the frame's tables. Bands that previous holds are copied from it instead,
+// previous has to be synthesized from the same spectrum at the same sample rate.
+inline std::shared_ptr<const FrameTables> synthesizeMultitable(const SpectralFrame& spectrum, const std::vector<float>& splitFreqs,
+	float sampleRate, std::pair<size_t, size_t> bandRange, const FrameTables* previous = nullptr) {
+	const auto [firstBand, lastBand] = bandRange;
+	std::vector<int> bandSizes;
+	for (auto band = firstBand; band <= lastBand; ++band) {
+		bandSizes.push_back(mipTablesize(spectrum.getTablesize(), splitFreqs.back(), splitFreqs[band]));
+	}
+	auto multitable = std::make_shared<FrameTables>(bandSizes, firstBand);
+	for (size_t i = 0; i < bandSizes.size(); ++i) {
+		const auto band = firstBand + i;
+		const auto splitFreq = splitFreqs[band];
+		float* data = multitable->writableData(i);
+		if (previous && band >= previous->firstBand() && band <= previous->lastBand()) {
+			std::copy_n(previous->band(band - previous->firstBand()).data, bandSizes[i] + 1, data);
+		} else {
+			const auto numHarmonics = std::min(static_cast<int>(sampleRate / 2.f / splitFreq), bandSizes[i] / 2 - 1);
+			spectrum.synthesize(data, bandSizes[i], numHarmonics);
+			data[bandSizes[i]] = data[0];
+		}
+		multitable->setMaxPlaybackFrequency(i, splitFreq);
+	}
+	return multitable;
+}
+
+// Spectral frame factory function with the bands for bandRange, see StackedFrames::getSpectralBands().
+// Runs the synthesis on the calling thread, e.g. the frame builder, so adding the frame only synthesizes bands
+// if the range changed in the meantime.
+inline Frame createSpectralFrame(const std::vector<float>& data, const std::vector<float>& splitFreqs, float sampleRate, std::pair<size_t, size_t> bandRange) {
+	auto frame = createSpectralFrame(data);
+	frame.multitable = synthesizeMultitable(*frame.spectrum, splitFreqs, sampleRate, bandRange);
+	frame.spectralSampleRate = sampleRate;
 	return frame;
 }
 
@@ -57,52 +202,48 @@ std::vector<float> calculateSplitFreqs(float semitones = 2.f, float highestSplit
 
 class StackedFrames
 {
-	using Multitable = std::vector<Wavetable<float>>;
-	using MultitableCollection = std::vector<Multitable>;
-	using State = MultitableCollection;
-	using Wavetable = Butterfly::Wavetable<float>;
-	using Osc = Butterfly::WavetableOscillator<Wavetable>;
+	using State = AudioProcessor::State;
 
 public:
 	//Ist es in Ordnung nur diesen Konstruktor zu implementieren?
-	StackedFrames(float sampleRate, int internalTablesize, float oscFreq, int maxFrames) : sampleRate(sampleRate), maxFrames(maxFrames), internalTablesize(internalTablesize) {
-		audioProcessor.init(oscFreq, sampleRate, maxFrames);
+	/// @param bandsReady  called from a worker thread when spectral bands have been synthesized in the background, must be
+	///                    thread-safe and trigger collectSpectralBands() on the main thread. Without it they are synthesized
+	///                    on the calling thread.
+	StackedFrames(float sampleRate, int internalTablesize, float oscFreq, int maxFrames, std::function<void()> bandsReady = {})
+		: maxFrames(maxFrames), internalTablesize(internalTablesize), sampleRate(sampleRate), oscFreq(oscFreq),
+		synthesizeInBackground(static_cast<bool>(bandsReady)), bandBuilder(std::move(bandsReady)) {
+		splitFreqs = calculateSplitFreqs(2.f, sampleRate / 2.f, 5.f);
+		spectralBands = wantedBands = calculateSpectralBands();
+		audioProcessor.init(oscFreq, sampleRate);
 		morphedWaveform.resize(internalTablesize, 0.f);
 		//frames.clearSelection();        //Not the way to go
 	}
 
-	template<int internalTablesize>
-	bool addFrame(const std::vector<float>& data, float sampleRate, const std::vector<float>& splitFreqs,
-		const Butterfly::FFTCalculator<float, internalTablesize>& fftCalculator) {
+	// Takes a frame from createFrame() or createSpectralFrame(), which may have been run on another thread
+	bool addFrame(Frame&& frame) {
 		if (frames.size() >= maxFrames) { return false; }
-		frames.add(createFrame(data, sampleRate, splitFreqs, fftCalculator));
+		applyTablesize(frame);
+		frames.add(std::move(frame));
+		applyStorageModes(); // the new frame may push an earlier one over the budget
 		frames.select(frames.size() - 1);
 		framesChanged();
 		return true;
 	}
 
+	// Gain edits only change the frame's gain, samples and tables stay untouched
 	void flipPhase() {
 		if (auto idx = frames.getSelectionIndex()) {
-			for (float& sample : frames.at(*idx).samples) {
-				sample *= -1.f;
-			}
-			for (auto& wavetable : frames.at(*idx).multitable) {
-				wavetable *= -1.f;
-			}
+			frames.at(*idx).gain *= -1.f;
 			framesChanged();
 		}
 	}
 
 	void normalize() {
 		if (auto idx = frames.getSelectionIndex()) {
-			//Get peak out of raw data (same normalization value for all tables in multitable)
-			const auto inv = minusOneDb / Butterfly::peak(frames.at(*idx).samples.begin(), frames.at(*idx).samples.end());
-			for (float& sample : frames.at(*idx).samples) {
-				sample *= inv;
-			}
-			for (auto& wavetable : frames.at(*idx).multitable) {
-				wavetable *= inv;
-			}
+			auto& frame = frames.at(*idx);
+			if (frame.peak <= 0.f) { return; }
+			//Peak of the raw data (same normalization value for all tables in multitable)
+			frame.gain = std::copysign(minusOneDb / frame.peak, frame.gain);
 			framesChanged();
 		}
 	}
@@ -130,12 +271,14 @@ public:
 	void removeSelectedFrame() {
 		if (auto idx = frames.getSelectionIndex()) {
 			frames.remove(*idx);
+			applyStorageModes(); // a spilled frame may fit now
 			framesChanged();
 		}
 	}
 
 	void clearAll() {
 		frames.clear();
+		fitBandCache();
 		framesChanged();
 	}
 
@@ -149,35 +292,113 @@ public:
 		return frames.getSelectionIndex();
 	}
 
-	std::optional<std::vector<float>> getConcatenatedFrames(int exportTablesize) {
-		if (frames.empty()) { return {}; }
-		//Objects for interpolation & concatenation
-		std::vector<float> concatenatedFrames{};
-		Osc interpolationOsc{};
-		double exportTableOscFreq = sampleRate / static_cast<float>(exportTablesize);
+	// Number of samples exportFrames() writes
+	size_t getExportSize(int exportTablesize) {
+		return frames.size() * static_cast<size_t>(std::max(exportTablesize, 0));
+	}
 
-		for (const auto& frame : frames) {
-			Wavetable wavetable{ frame.samples, sampleRate / 2.f };
-			std::span<Wavetable> wavetableSpan{ &wavetable, 1 };
-			std::vector<float> interpolatedWavetable{};
-			interpolationOsc.setTable(&wavetableSpan);
-			interpolationOsc.setSampleRate(sampleRate);
-			interpolationOsc.setFrequency(exportTableOscFreq);
-			for (int i = 0; i < exportTablesize; ++i) {
-				interpolatedWavetable.push_back(interpolationOsc++);
-			}
-			concatenatedFrames.insert(concatenatedFrames.end(), interpolatedWavetable.begin(), interpolatedWavetable.end());
-		}
-		return concatenatedFrames;
+	/// @brief Resamples all frames (gain applied) to exportTablesize samples each, one after another.
+	/// Frames are independent, so they are resampled in parallel with one filter bank, each straight into its part of out.
+	/// @param out  getExportSize(exportTablesize) samples, e.g. a locked buffer~
+	void exportFrames(float* out, int exportTablesize, ResamplerQuality quality = ResamplerQuality::normal) {
+		if (exportTablesize <= 0 || frames.empty()) { return; }
+		const PeriodicResampler resampler{ static_cast<int>(internalTablesize), exportTablesize, quality };
+		sharedThreadPool().parallelFor(frames.size(), [&](size_t idx) {
+			const auto& frame = frames.at(idx);
+			resampler.process(frame.samples.data(), out + idx * exportTablesize, frame.gain);
+		});
 	}
 
 	size_t getNumFrames() {
 		return frames.size();
 	}
 
+	const std::vector<float>& getSplitFreqs() const { return splitFreqs; }
+
+	// Bands spectral frames hold, [first, last], see createSpectralFrame(). Lags behind the frequencies that are played
+	// while bands are synthesized in the background.
+	std::pair<size_t, size_t> getSpectralBands() const { return spectralBands; }
+
+	size_t getInternalTablesize() const { return internalTablesize; }
+
+	// Resamples all frames and rebuilds their tables on the calling thread (and the shared thread pool)
+	void setInternalTablesize(int tablesize) {
+		if (!isSupportedTablesize(tablesize) || static_cast<size_t>(tablesize) == internalTablesize) { return; }
+		internalTablesize = tablesize;
+		morphedWaveform.assign(internalTablesize, 0.f);
+		for (size_t i = 0; i < frames.size(); ++i) {
+			applyTablesize(frames.at(i));
+		}
+		applyStorageModes();
+		if (!frames.empty()) { framesChanged(); }
+	}
+
+	/// @brief Memory for the frames' tables and spectra and the cached bands, see getTablesSizeInBytes().
+	/// Spilled frames count with their spectrum and the bands they hold. Frames are rendered fully in frame order
+	/// as long as the rest still fits in spectral storage, checked whenever frames are added or removed or the budget
+	/// changes, and when wider bands push the frames over the budget. The band cache gets what is left.
+	/// The budget can't go below the spectral storage of all frames, see exceedsMemoryBudget().
+	void setMemoryBudget(size_t bytes) {
+		memoryBudget = bytes;
+		if (applyStorageModes()) { framesChanged(); }
+	}
+
+	// Memory held by the frames' tables and spectra and by cached bands, without the raw samples
+	size_t getTablesSizeInBytes() {
+		return getFramesSizeInBytes() + bandCache.unusedBytes();
+	}
+
+	// Even with all frames in spectral storage, e.g. with a wide frequency range
+	bool exceedsMemoryBudget() {
+		return getTablesSizeInBytes() > memoryBudget;
+	}
+
+	//=====================================
+	//          SPECTRAL STORAGE
+	//=====================================
+	// Converts all frames on the calling thread, spectral frames take the bands they already hold from the cache
+	void setStorageMode(StorageMode mode) {
+		if (mode == storageMode) { return; }
+		storageMode = mode;
+		if (applyStorageModes()) { framesChanged(); }
+	}
+
+	/// @brief Range of the frequency signal. Spectral frames hold the bands for it in addition to the bands for
+	/// setOscFreq() and the held notes, a frequency signal outside of it plays the nearest band they hold.
+	/// @param highestFreq  0: no frequency signal, the bands follow setOscFreq() and the notes only
+	void setFrequencyRange(float lowestFreq, float highestFreq) {
+		if (std::max(lowestFreq, highestFreq) <= 0.f) {
+			this->lowestFreq = this->highestFreq = 0.f;
+		} else {
+			this->lowestFreq = std::max(std::min(lowestFreq, highestFreq), 1.f);
+			this->highestFreq = std::max(lowestFreq, highestFreq);
+		}
+		updateSpectralBands();
+	}
+
+	/// @brief Main thread: adopts the bands synthesized in the background, see bandsReady of the constructor.
+	/// @param failed  called with the reason of each failed synthesis, the bands are not requested again until they change
+	template<class FailFn>
+	void collectSpectralBands(FailFn&& failed) {
+		bandBuilder.collect([this](SpectralBands&& result) {
+			for (auto& [spectrumId, tables] : result.tables) {
+				bandCache.insert({ spectrumId, result.sampleRate, result.bands }, std::move(tables));
+			}
+		}, [&](const std::string& error) {
+			failedBands = submittedBands;
+			failed(error);
+		});
+		requestSpectralBands();
+		fitBandCache(); // bands of a window the oscillator has already left
+	}
+
+	// Samples with the frame's gain applied
 	std::optional<std::vector<float>> getFrame(size_t idx) {
 		if (idx >= frames.size()) { return {}; }
-		return frames.at(idx).samples;
+		const auto& frame = frames.at(idx);
+		std::vector<float> samples(frame.samples.size());
+		std::transform(frame.samples.begin(), frame.samples.end(), samples.begin(), [&frame](float sample) { return sample * frame.gain; });
+		return samples;
 	}
 
 	float getNormalizedMorphPos() { return normalizedMorphPos; }
@@ -195,27 +416,91 @@ public:
 	//               AUDIO
 	//=====================================
 	// Audio thread only!
-	void process(c74::min::audio_bundle& buffer) {
-		audioProcessor.process(buffer);
+	void process(c74::min::audio_bundle& buffer, const SignalInputs& signals = {}) {
+		audioProcessor.process(buffer, signals);
+	}
+
+	// Audio thread only! Multichannel variant, see enableChannels()
+	void processChannels(c74::min::audio_bundle& buffer, const c74::min::sample* const* frequencySignals = nullptr, int numFrequencySignals = 0) {
+		audioProcessor.processChannels(buffer, frequencySignals, numFrequencySignals);
+	}
+
+	/// @brief Prepares processChannels(), before the audio thread starts
+	void enableChannels() {
+		audioProcessor.enableChannels();
+	}
+
+	/// @param frequencyOffsets  cents per channel, the last one applies to all further channels
+	/// @param morphOffsets      added to the morph position per channel, the last one applies to all further channels
+	void setChannelLayout(int numChannels, const std::vector<float>& frequencyOffsets, const std::vector<float>& morphOffsets) {
+		audioProcessor.changeChannelLayout({ numChannels, frequencyOffsets, morphOffsets });
 	}
 
 	void setSampleRate(float sampleRate) {
 		this->sampleRate = sampleRate;
+		if (applyStorageModes()) { framesChanged(); } // the number of harmonics per band depends on the sample rate
 		audioProcessor.addParamEvent({ ParameterType::sampleRate, sampleRate });
 	}
 
-	void setNormalizedMorphPos(float morphPos) {
+	/// Sample time delayMs milliseconds after the block the audio thread renders next, for the time parameter of the setters below
+	int64_t sampleTimeIn(double delayMs) const {
+		return audioProcessor.getSampleTime() + std::llround(std::max(delayMs, 0.) * sampleRate / 1000.);
+	}
+
+	/// @param time  sample time the change takes effect at on the audio thread, see sampleTimeIn()
+	void setNormalizedMorphPos(float morphPos, int64_t time = Event::immediate) {
 		normalizedMorphPos = std::clamp(morphPos, 0.f, 1.f);
 		updateMorphedWaveform();
-		audioProcessor.addParamEvent({ ParameterType::morphPos, normalizedMorphPos });
+		audioProcessor.addParamEvent({ ParameterType::morphPos, normalizedMorphPos, time });
+	}
+
+	void setOscFreq(double oscFreq, int64_t time = Event::immediate) {
+		this->oscFreq = static_cast<float>(std::clamp(oscFreq, 1., sampleRate / 2.));
+		updateSpectralBands();
+		audioProcessor.addParamEvent({ ParameterType::frequency, this->oscFreq, time });
+	}
+
+	void setOscGain(double gain, int64_t time = Event::immediate) {
+		audioProcessor.addParamEvent({ ParameterType::gain, std::clamp(gain, 0., 1.), time });
+	}
+
+	/// @param numVoices  0: one oscillator at the frequency set with setOscFreq(), otherwise notes play polyphonically
+	void setNumVoices(int numVoices) {
+		audioProcessor.addParamEvent({ ParameterType::numVoices, static_cast<double>(std::clamp(numVoices, 0, VoiceBank::maxVoices)) });
+	}
+
+	/// @param numVoices  1..16 detuned copies of the oscillator, 1 is off
+	void setUnisonVoices(int numVoices) {
+		audioProcessor.addParamEvent({ ParameterType::unisonVoices, static_cast<double>(std::clamp(numVoices, 1, MorphingBlockOscillator::maxUnisonVoices)) });
+	}
+
+	/// @param detuneCents  detune of the outermost copies
+	void setUnisonDetune(double detuneCents) {
+		audioProcessor.addParamEvent({ ParameterType::unisonDetune, std::max(detuneCents, 0.) });
+	}
+
+	/// @param width  0: mono, 1: outermost copies hard left and right
+	void setUnisonWidth(double width) {
+		audioProcessor.addParamEvent({ ParameterType::unisonWidth, std::clamp(width, 0., 1.) });
 	}
 
-	void setOscFreq(double oscFreq) {
-		audioProcessor.addParamEvent({ ParameterType::frequency, std::clamp(oscFreq, 1., sampleRate / 2.) });
+	/// @param samplesPerFrame  morph glide time for a distance of one frame, see MorphGlide
+	void setMorphGlide(int samplesPerFrame) {
+		audioProcessor.addParamEvent({ ParameterType::morphGlide, static_cast<double>(std::max(samplesPerFrame, 1)) });
 	}
 
-	void setOscGain(double gain) {
-		audioProcessor.addParamEvent({ ParameterType::gain, std::clamp(gain, 0., 1.) });
+	/// @param factor  1, 2 or 4, renders at factor times the sample rate and decimates. Not applied to processChannels().
+	void setOversampling(int factor) {
+		audioProcessor.addParamEvent({ ParameterType::oversampling, static_cast<double>(factor) });
+	}
+
+	/// @param velocity  0..127, 0 is a note off
+	void playNote(int note, float velocity, int64_t time = Event::immediate, float morph = VoiceBank::sharedMorph) {
+		if (note >= 0 && static_cast<size_t>(note) < heldNotes.size()) {
+			heldNotes[note] = velocity > 0.f;
+			updateSpectralBands();
+		}
+		audioProcessor.addParamEvent({ ParameterType::note, static_cast<double>(note), time, std::clamp(velocity, 0.f, 127.f), morph });
 	}
 
 private:
@@ -224,8 +509,10 @@ private:
 		const auto [currentFirstTable, fracMorphPos] = computeMorphingStuff(normalizedMorphPos, frames.size()); //structured binding
 		const auto& firstFrame = frames[currentFirstTable];
 		const auto& secondFrame = frames[currentFirstTable + 1];
+		const auto firstGain = firstFrame.gain * (1.f - fracMorphPos);
+		const auto secondGain = secondFrame.gain * fracMorphPos;
 		for (size_t i = 0; i < morphedWaveform.size(); i++) {
-			morphedWaveform[i] = firstFrame.samples[i] * (1.f - fracMorphPos) + secondFrame.samples[i] * fracMorphPos;
+			morphedWaveform[i] = firstFrame.samples[i] * firstGain + secondFrame.samples[i] * secondGain;
 		}
 	}
 	/*
@@ -236,14 +523,200 @@ private:
         updateMorphedWaveform();
     }
     */
+	// Publishes pointers and gains only, frames that did not change stay shared with the previous state
 	void sendFramesToAudioProcessor() {
 		State state;
 		for (const auto& frame : frames) {
-			state.push_back(frame.multitable);
+			state.add(frame.multitable, frame.gain);
 		}
 		audioProcessor.changeState(std::move(state));
 	}
 
+	// Resamples a frame of another table size, e.g. one that was pending while the size changed
+	void applyTablesize(Frame& frame) {
+		if (frame.samples.size() == internalTablesize) { return; }
+		const auto samples = resamplePeriod(frame.samples, static_cast<int>(internalTablesize));
+		Frame resized = frame.spectrum ? createSpectralFrame(samples) : createFrame(samples, sampleRate, splitFreqs);
+		resized.gain = frame.gain;
+		frame = std::move(resized);
+	}
+
+	/// @brief Brings a frame into the current storage mode, spilling it to spectral storage if it exceeds the memory budget.
+	/// @param usedBytes      memory of the frames so far, including this one on return
+	/// @param reservedBytes  memory of the frames after this one in spectral storage
+	/// @return whether the frame's tables changed
+	bool applyStorageMode(Frame& frame, size_t& usedBytes, size_t reservedBytes) {
+		const auto fullBytes = getFullTablesSizeInBytes(frame.samples.size());
+		if (storageMode == StorageMode::tables && usedBytes + fullBytes + reservedBytes <= memoryBudget) {
+			usedBytes += fullBytes;
+			if (!frame.spectrum) { return false; }
+			frame.multitable = synthesizeMultitable(*frame.spectrum, splitFreqs, sampleRate, { 0, splitFreqs.size() - 1 }, reusableTables(frame));
+			frame.spectrum.reset();
+			return true;
+		}
+		usedBytes += getSpectralSizeInBytes(frame.samples.size());
+		if (!frame.spectrum) {
+			frame.spectrum = std::make_shared<SpectralFrame>(frame.samples);
+			frame.multitable.reset(); // rendered by the Antialiaser, not from the spectrum
+		}
+		const auto& tables = frame.multitable;
+		const BandCache::Key key{ frame.spectrum->getId(), sampleRate, spectralBands };
+		if (tables && frame.spectralSampleRate == sampleRate && tables->firstBand() == spectralBands.first && tables->lastBand() == spectralBands.second) {
+			if (!bandCache.find(key)) { bandCache.insert(key, tables); } // e.g. synthesized by the frame builder
+			return false;
+		}
+		auto cached = bandCache.find(key);
+		if (!cached) {
+			cached = synthesizeMultitable(*frame.spectrum, splitFreqs, sampleRate, spectralBands, reusableTables(frame));
+			bandCache.insert(key, cached);
+		}
+		frame.multitable = std::move(cached);
+		frame.spectralSampleRate = sampleRate;
+		return true;
+	}
+
+	// Tables of a spectral frame that synthesizeMultitable() can copy bands from
+	const FrameTables* reusableTables(const Frame& frame) const {
+		return frame.spectrum && frame.spectralSampleRate == sampleRate ? frame.multitable.get() : nullptr;
+	}
+
+	// All frames in frame order, returns whether any tables changed
+	bool applyStorageModes() {
+		size_t usedBytes{};
+		bool changed = false;
+		const auto spectralBytes = getSpectralSizeInBytes(internalTablesize);
+		for (size_t i = 0; i < frames.size(); ++i) {
+			changed |= applyStorageMode(frames.at(i), usedBytes, (frames.size() - 1 - i) * spectralBytes);
+		}
+		fitBandCache();
+		return changed;
+	}
+
+	// The cache keeps unused bands in what is left of the memory budget, up to defaultBandCacheSize
+	void fitBandCache() {
+		const auto usedBytes = std::min(getFramesSizeInBytes(), memoryBudget);
+		bandCache.setCapacity(std::min(memoryBudget - usedBytes, defaultBandCacheSize));
+	}
+
+	// Size of a fully rendered frame of tablesize samples
+	size_t getFullTablesSizeInBytes(size_t tablesize) const {
+		std::vector<int> bandSizes(splitFreqs.size());
+		std::transform(splitFreqs.begin(), splitFreqs.end(), bandSizes.begin(), [&](float splitFreq) {
+			return mipTablesize(static_cast<int>(tablesize), splitFreqs.back(), splitFreq);
+		});
+		return FrameTables::requiredBytes(bandSizes);
+	}
+
+	// Size of a frame of tablesize samples in spectral storage: the spectrum and the spectralBands
+	size_t getSpectralSizeInBytes(size_t tablesize) const {
+		std::vector<int> bandSizes;
+		for (auto band = spectralBands.first; band <= spectralBands.second; ++band) {
+			bandSizes.push_back(mipTablesize(static_cast<int>(tablesize), splitFreqs.back(), splitFreqs[band]));
+		}
+		return SpectralFrame::requiredBytes(static_cast<int>(tablesize)) + FrameTables::requiredBytes(bandSizes);
+	}
+
+	// Memory of the frames' tables and spectra
+	size_t getFramesSizeInBytes() {
+		size_t bytes{};
+		for (const auto& frame : frames) {
+			bytes += frame.multitable->sizeInBytes() + (frame.spectrum ? frame.spectrum->sizeInBytes() : 0);
+		}
+		return bytes;
+	}
+
+	// Bands the oscillator reaches with setOscFreq(), the held notes and the frequency range, plus spectralBandMargin
+	// bands on either side for unison detune and vibrato
+	std::pair<size_t, size_t> calculateSpectralBands() const {
+		float lowest = oscFreq, highest = oscFreq;
+		for (size_t note = 0; note < heldNotes.size(); ++note) {
+			if (!heldNotes[note]) { continue; }
+			const auto frequency = VoiceBank::noteToFrequency(static_cast<int>(note));
+			lowest = std::min(lowest, frequency);
+			highest = std::max(highest, frequency);
+		}
+		if (highestFreq > 0.f) {
+			lowest = std::min(lowest, lowestFreq);
+			highest = std::max(highest, highestFreq);
+		}
+		const auto [first, last] = calculateBandRange(splitFreqs, lowest, highest);
+		return { first - std::min(first, spectralBandMargin), std::min(last + spectralBandMargin, splitFreqs.size() - 1) };
+	}
+
+	void updateSpectralBands() {
+		const auto bands = calculateSpectralBands();
+		if (bands == wantedBands) { return; }
+		wantedBands = bands;
+		failedBands = { 1, 0 };
+		requestSpectralBands();
+	}
+
+	/// @brief Brings the spectral frames to wantedBands. All frames of a state have to hold the bands the oscillator
+	/// selects (see selectBands()), so the bands are published for all frames at once: right away if the cache has
+	/// them, otherwise once they have been synthesized. Until then the oscillator plays the nearest bands it has.
+	/// One job at a time synthesizes the missing bands in the background, requests in the meantime are merged.
+	void requestSpectralBands() {
+		if (wantedBands == spectralBands || bandBuilder.numPending() > 0) { return; }
+		std::vector<size_t> missing;
+		for (size_t idx = 0; idx < frames.size(); ++idx) {
+			const auto& frame = frames.at(idx);
+			if (frame.spectrum && !bandCache.find({ frame.spectrum->getId(), sampleRate, wantedBands })) { missing.push_back(idx); }
+		}
+		if (!missing.empty()) {
+			if (synthesizeInBackground) {
+				if (wantedBands != failedBands) { submitSpectralBands(missing); }
+				return;
+			}
+			// Frames are independent, so they are synthesized in parallel, bands they already hold are copied
+			std::vector<std::shared_ptr<const FrameTables>> synthesized(missing.size());
+			sharedThreadPool().parallelFor(missing.size(), [&](size_t i) {
+				const auto& frame = frames.at(missing[i]);
+				synthesized[i] = synthesizeMultitable(*frame.spectrum, splitFreqs, sampleRate, wantedBands, reusableTables(frame));
+			});
+			for (size_t i = 0; i < missing.size(); ++i) {
+				bandCache.insert({ frames.at(missing[i]).spectrum->getId(), sampleRate, wantedBands }, std::move(synthesized[i]));
+			}
+		}
+		spectralBands = wantedBands;
+		bool changed = false;
+		for (size_t idx = 0; idx < frames.size(); ++idx) {
+			auto& frame = frames.at(idx);
+			if (!frame.spectrum) { continue; }
+			frame.multitable = bandCache.find({ frame.spectrum->getId(), sampleRate, spectralBands });
+			frame.spectralSampleRate = sampleRate;
+			changed = true;
+		}
+		if (getFramesSizeInBytes() > memoryBudget) {
+			changed |= applyStorageModes(); // wider bands, spills more frames
+		} else {
+			fitBandCache();
+		}
+		if (changed) { framesChanged(); }
+	}
+
+	// The job only holds references to the spectra and tables, frames may be removed while it runs
+	void submitSpectralBands(const std::vector<size_t>& missing) {
+		struct Source
+		{
+			std::shared_ptr<const SpectralFrame> spectrum;
+			std::shared_ptr<const FrameTables> previous;	// bands to copy
+		};
+		submittedBands = wantedBands;
+		std::vector<Source> sources;
+		for (const auto idx : missing) {
+			const auto& frame = frames.at(idx);
+			sources.push_back({ frame.spectrum, reusableTables(frame) ? frame.multitable : nullptr });
+		}
+		bandBuilder.submit([sources = std::move(sources), splitFreqs = splitFreqs, sampleRate = sampleRate, bands = wantedBands] {
+			SpectralBands result{ bands, sampleRate };
+			for (const auto& source : sources) {
+				result.tables.emplace_back(source.spectrum->getId(),
+					synthesizeMultitable(*source.spectrum, splitFreqs, sampleRate, bands, source.previous.get()));
+			}
+			return result;
+		});
+	}
+
 	void framesChanged() {
 		updateMorphedWaveform();
 		sendFramesToAudioProcessor();
@@ -255,10 +728,23 @@ private:
 	//int currentFirstTable{};
 	//float fracMorphPos{};
 	float normalizedMorphPos{};
-	float sampleRate{};
-	ReleasePool<MultitableCollection> releasePool;
+	float sampleRate{}, oscFreq{};
+
+	std::vector<float> splitFreqs;
+	StorageMode storageMode{ StorageMode::tables };
+	float lowestFreq{}, highestFreq{};				// of the frequency signal, 0: none
+	std::bitset<128> heldNotes;
+	static constexpr size_t spectralBandMargin = 1;
+	std::pair<size_t, size_t> spectralBands;		// [first, last], held by the spectral frames
+	std::pair<size_t, size_t> wantedBands;			// for the frequencies that are played
+	std::pair<size_t, size_t> submittedBands;		// of the last job
+	std::pair<size_t, size_t> failedBands{ 1, 0 };	// last bands that could not be synthesized, none
+	size_t memoryBudget{ defaultMemoryBudget };
+	BandCache bandCache{ defaultBandCacheSize };
+	bool synthesizeInBackground{};
 
 	AudioProcessor audioProcessor;
+	AsyncBuilder<SpectralBands> bandBuilder;		// last: waits for running jobs before anything else is destroyed
 };
 
 }
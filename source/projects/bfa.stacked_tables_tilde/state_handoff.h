@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace Butterfly {
+
+/// @brief Wait-free handoff of immutable state from a single writer (UI thread) to a single reader (audio thread).
+/// The reader does one atomic load and two stores per acquire(), without touching any reference count.
+/// The reader announces the state it holds, the writer frees every replaced state but that one. While the reader is
+/// between its two stores the writer can't tell which state it loads and frees nothing, the next publish() or
+/// reclaim() catches up. So at most the published state and the one the reader holds stay pinned, also while the
+/// reader is idle (dsp off).
+template<class T>
+class StateHandoff
+{
+public:
+	// UI thread only!
+	void publish(std::shared_ptr<T> state) {
+		current.store(state.get());
+		if (published) { retired.push_back(std::move(published)); }
+		published = std::move(state);
+		reclaim();
+	}
+
+	// UI thread only! Unpins all replaced states the reader doesn't hold.
+	void reclaim() {
+		// any acquire() after this load sees the current state, which isn't retired
+		const T* held = reading.load();
+		if (held == loading()) { return; }
+		std::erase_if(retired, [held](const std::shared_ptr<T>& state) { return state.get() != held; });
+	}
+
+	// Audio thread only! The returned state stays valid until the next call.
+	T* acquire() {
+		reading.store(loading());
+		T* state = current.load();
+		reading.store(state);
+		return state;
+	}
+
+	// For testing
+	size_t numPinned() const { return retired.size() + (published ? 1 : 0); }
+
+private:
+	// marks the reader between its two stores, never a valid state
+	const T* loading() const { return reinterpret_cast<const T*>(&reading); }
+
+	std::atomic<T*> current{};
+	std::atomic<const T*> reading{};
+	std::shared_ptr<T> published;
+	std::vector<std::shared_ptr<T>> retired;
+};
+
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace Butterfly {
+
+/// Fixed set of worker threads for heavy UI side work such as band-limiting.
+/// Never to be used from the audio thread.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned numWorkers) {
+		for (unsigned i = 0; i < numWorkers; ++i) {
+			workers.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::scoped_lock lock{ mutex };
+			stopping = true;
+		}
+		condition.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t numWorkers() const { return workers.size(); }
+
+	// Without workers (single core machines) the task runs right away on the calling thread
+	void submit(std::function<void()> task) {
+		if (workers.empty()) {
+			task();
+			return;
+		}
+		{
+			std::scoped_lock lock{ mutex };
+			tasks.push(std::move(task));
+		}
+		condition.notify_one();
+	}
+
+	/// @brief Calls fn(i) for every i in [0, count) and returns when all calls have finished.
+	/// The calling thread takes part, so this doesn't deadlock when called from a worker.
+	template<class Fn>
+	void parallelFor(size_t count, Fn&& fn) {
+		if (count == 0) { return; }
+		struct Batch
+		{
+			std::atomic<size_t> next{};
+			size_t done{};
+			std::exception_ptr error;
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		auto batch = std::make_shared<Batch>();
+		auto run = [batch, count, &fn] {
+			for (size_t i = batch->next++; i < count; i = batch->next++) {
+				std::exception_ptr error;
+				try {
+					fn(i);
+				} catch (...) {
+					error = std::current_exception();
+				}
+				std::scoped_lock lock{ batch->mutex };
+				if (error && !batch->error) { batch->error = error; }
+				if (++batch->done == count) { batch->finished.notify_all(); }
+			}
+		};
+		const auto numHelpers = std::min(count - 1, workers.size());
+		for (size_t i = 0; i < numHelpers; ++i) {
+			submit(run);
+		}
+		run();
+		std::unique_lock lock{ batch->mutex };
+		batch->finished.wait(lock, [&] { return batch->done == count; });
+		if (batch->error) { std::rethrow_exception(batch->error); }
+	}
+
+private:
+	void workerLoop() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock lock{ mutex };
+				condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty()) { return; }
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping{ false };
+};
+
+namespace detail {
+struct SharedThreadPoolState
+{
+	std::mutex mutex;
+	std::unique_ptr<ThreadPool> pool;
+	size_t numUsers{};
+};
+
+inline SharedThreadPoolState& sharedThreadPoolState() {
+	static SharedThreadPoolState state;
+	return state;
+}
+}
+
+/// All instances share one pool, sized to leave one core for Max' main thread.
+/// Created on first use and kept while a ThreadPoolUser exists.
+inline ThreadPool& sharedThreadPool() {
+	auto& state = detail::sharedThreadPoolState();
+	std::scoped_lock lock{ state.mutex };
+	if (!state.pool) {
+		state.pool = std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	}
+	return *state.pool;
+}
+
+/// Keeps the shared pool alive, one per object instance. The last one shuts the pool down and joins its workers,
+/// i.e. when the last instance is freed, not in a static destructor while the external unloads: joining threads
+/// under the Windows loader lock can deadlock.
+/// Declare it before everything that submits to the pool, so running tasks have finished when it goes.
+class ThreadPoolUser
+{
+public:
+	ThreadPoolUser() {
+		auto& state = detail::sharedThreadPoolState();
+		std::scoped_lock lock{ state.mutex };
+		++state.numUsers;
+	}
+
+	~ThreadPoolUser() {
+		auto& state = detail::sharedThreadPoolState();
+		std::unique_ptr<ThreadPool> pool;
+		{
+			std::scoped_lock lock{ state.mutex };
+			if (--state.numUsers == 0) { pool = std::move(state.pool); }
+		}
+		// joined here, outside the lock
+	}
+
+	ThreadPoolUser(const ThreadPoolUser&) = delete;
+	ThreadPoolUser& operator=(const ThreadPoolUser&) = delete;
+};
+
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+namespace Butterfly {
+
+/// @brief Fixed pool of oscillator voices for polyphonic playback, audio thread only.
+/// Voice data is kept in structure-of-arrays form so the renderer can load several voices into one SIMD register.
+/// Nothing allocates: a note on without a free voice steals the oldest released voice, or else the oldest one.
+/// Level changes ramp over levelRampSamples samples, however the rendering is split into segments.
+class VoiceBank
+{
+public:
+	static constexpr int maxVoices = 16;
+	static constexpr int levelRampSamples = 64;
+	static constexpr float sharedMorph = -1.f; // a voice without a morph position of its own
+
+	/// @param numVoices  voices used from now on, voices above are released
+	void setNumVoices(int numVoices) {
+		this->numVoices = std::clamp(numVoices, 0, maxVoices);
+		for (int v = this->numVoices; v < maxVoices; ++v) {
+			rampTo(v, 0.f);
+		}
+	}
+
+	int getNumVoices() const { return numVoices; }
+
+	/// @param velocity  0..127, 0 is a note off
+	/// @param morph     the voice's own morph position in [0, 1], sharedMorph (or any negative or non-finite value):
+	///                  the morph position of the oscillator
+	void noteOn(int note, float velocity, float morph = sharedMorph) {
+		if (velocity <= 0.f) {
+			noteOff(note);
+			return;
+		}
+		if (numVoices == 0) { return; }
+		const int voice = findVoice(note);
+		if (!active[voice] || notes[voice] != note) {
+			// a free voice starts at phase zero, a stolen one keeps its phase and glides over one block
+			if (!active[voice]) { phases[voice] = 0.f; }
+			frequencies[voice] = noteToFrequency(note);
+		}
+		notes[voice] = note;
+		ownMorph[voice] = std::isfinite(morph) && morph >= 0.f;
+		morphs[voice] = ownMorph[voice] ? std::min(morph, 1.f) : 0.f;
+		rampTo(voice, velocity / 127.f);
+		active[voice] = true;
+		ages[voice] = ++noteCounter;
+	}
+
+	void noteOff(int note) {
+		for (int v = 0; v < maxVoices; ++v) {
+			if (active[v] && notes[v] == note) { rampTo(v, 0.f); }
+		}
+	}
+
+	void allNotesOff() {
+		for (int v = 0; v < maxVoices; ++v) {
+			rampTo(v, 0.f);
+		}
+	}
+
+	int numActive() const {
+		return static_cast<int>(std::count(active.begin(), active.end(), true));
+	}
+
+	/// @brief Increments and per-sample level steps for the next n samples. A ramp continues where the last block left
+	/// off, one that would end within the block is stretched to its end, so ramps never get shorter.
+	void prepareBlock(int n, float invSampleRate) {
+		for (int v = 0; v < maxVoices; ++v) {
+			increments[v] = frequencies[v] * invSampleRate;
+			levelSteps[v] = rampSamplesLeft[v] > 0 ? (targetLevels[v] - levels[v]) / static_cast<float>(std::max(rampSamplesLeft[v], n)) : 0.f;
+			rampSamplesLeft[v] = std::max(rampSamplesLeft[v] - n, 0);
+		}
+	}
+
+	/// @brief Removes the ramping error of finished ramps and frees voices that have faded out.
+	void finishBlock() {
+		for (int v = 0; v < maxVoices; ++v) {
+			if (rampSamplesLeft[v] > 0) { continue; }
+			levels[v] = targetLevels[v];
+			if (active[v] && levels[v] == 0.f) { active[v] = false; }
+		}
+	}
+
+	static float noteToFrequency(int note) {
+		return 440.f * std::exp2(static_cast<float>(note - 69) / 12.f);
+	}
+
+	alignas(32) std::array<float, maxVoices> phases{};
+	alignas(32) std::array<float, maxVoices> increments{};
+	alignas(32) std::array<float, maxVoices> levels{};
+	alignas(32) std::array<float, maxVoices> levelSteps{};
+	alignas(32) std::array<float, maxVoices> targetLevels{};
+	alignas(32) std::array<float, maxVoices> frequencies{};
+	alignas(32) std::array<float, maxVoices> morphs{};		// own morph position, if ownMorph
+	std::array<int, maxVoices> rampSamplesLeft{};
+	std::array<int, maxVoices> notes{};
+	std::array<uint32_t, maxVoices> ages{};
+	std::array<bool, maxVoices> active{};
+	std::array<bool, maxVoices> ownMorph{};
+
+private:
+	void rampTo(int voice, float level) {
+		if (level == targetLevels[voice]) { return; }
+		targetLevels[voice] = level;
+		rampSamplesLeft[voice] = levelRampSamples;
+	}
+
+	// Voice already playing the note, a free one, the oldest released one or the oldest one, in this order
+	int findVoice(int note) const {
+		int freeVoice = -1, oldestReleased = -1, oldest = 0;
+		for (int v = 0; v < numVoices; ++v) {
+			if (active[v] && notes[v] == note) { return v; }
+			if (!active[v]) {
+				if (freeVoice < 0) { freeVoice = v; }
+				continue;
+			}
+			if (targetLevels[v] == 0.f && (oldestReleased < 0 || ages[v] < ages[oldestReleased])) { oldestReleased = v; }
+			if (ages[v] < ages[oldest]) { oldest = v; }
+		}
+		if (freeVoice >= 0) { return freeVoice; }
+		return oldestReleased >= 0 ? oldestReleased : oldest;
+	}
+
+	int numVoices{};
+	uint32_t noteCounter{};
+};
+
+}
@@ -66,6 +66,7 @@ public:
 
 	attribute<symbol> inputBufferName{ this, "Input Buffer", "inputBuffer", description{ "Name of buffer~ to read from." } };
 	attribute<symbol> targetBufferName{ this, "Target Buffer", "targetBuffer", description{ "Name of buffer~ to write to" } };
+	attribute<symbol> exportQuality{ this, "export_quality", "normal", description{ "Resampling quality of the exported frame: draft, normal or high." }, range{ "draft", "normal", "high" } };
 
 	attribute<number> waveformYScaling{ this, "Waveform Y Scaling Factor", 0.9 };
 	attribute<number> zoomSpeed{ this, "Mouse wheel zoom speed", 1.1 };
@@ -226,7 +227,9 @@ bool table_preprocessing::exportFrame() {
 	if (!buf.valid()) return false;
 	const auto size = buf.frame_count();
 
-	auto result = samplePreprocessor.exportFrame(size);
+	const symbol quality = exportQuality;
+	const auto resamplerQuality = quality == "draft" ? ResamplerQuality::draft : quality == "high" ? ResamplerQuality::high : ResamplerQuality::normal;
+	auto result = samplePreprocessor.exportFrame(size, resamplerQuality);
 	if (result) {
 		auto data = *result;
 		for (int i = 0; i < size; i++) {
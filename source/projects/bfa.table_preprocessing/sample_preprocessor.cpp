@@ -58,22 +58,16 @@ std::pair<int, int> SamplePreprocessor::getCurrentExportRange() const {
 	return {};
 }
 
-std::optional<std::vector<double>> SamplePreprocessor::exportFrame(int targetTablesize) {
+std::optional<std::vector<double>> SamplePreprocessor::exportFrame(int targetTablesize, ResamplerQuality quality) {
 	if (!canExport()) return std::nullopt;
 
 	std::vector<double> data(targetTablesize);
 	const auto [begin, end] = getCurrentExportRange();
 
+	// The selection is one period, so it is resampled periodically and band-limited to the target size
 	const std::vector<float> selectedSamples{ inputSamples.begin() + begin, inputSamples.begin() + end };
-	const float exportTableOscFreq = sampleRate / static_cast<float>(targetTablesize);
-
-	const Wavetable table{ selectedSamples, sampleRate / 2.f };
-	std::vector<Wavetable> wavetable{ table };
-	Osc interpolationOscillator{ &wavetable, sampleRate, exportTableOscFreq };
-
-	for (int i = 0; i < targetTablesize; i++) {
-		data[i] = interpolationOscillator++;
-	}
+	const PeriodicResampler resampler{ static_cast<int>(selectedSamples.size()), targetTablesize, quality };
+	resampler.process(selectedSamples.data(), data.data());
 	return std::move(data);
 }
 
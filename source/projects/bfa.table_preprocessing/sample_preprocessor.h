@@ -12,6 +12,7 @@
 #include "event.h"
 #include "graphics_transform.h"
 #include "wavetable_oscillator.h"
+#include "../shared/periodic_resampler.h"
 
 
 namespace Butterfly {
@@ -53,7 +54,6 @@ struct SamplePreprocessor
 {
 public:
 	using Wavetable = Wavetable<float>;
-	using Osc = WavetableOscillator<Wavetable>;
 
 
 	enum class Mode {
@@ -76,7 +76,7 @@ public:
 	void mousewheelImpl(const MouseEvent& e);
 
 	bool canExport() const;
-	std::optional<std::vector<double>> exportFrame(int targetTablesize);
+	std::optional<std::vector<double>> exportFrame(int targetTablesize, ResamplerQuality quality = ResamplerQuality::normal);
 
 private:
 
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BFA_RESAMPLER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Butterfly {
+
+enum class ResamplerQuality {
+	draft,	// 8 zero crossings, 64 phases
+	normal,	// 16 zero crossings, 256 phases
+	high	// 32 zero crossings, 1024 phases
+};
+
+/// @brief Polyphase windowed-sinc (Kaiser) resampler for one period of a periodic signal, e.g. a single-cycle frame.
+/// Arbitrary ratios: the filter bank is computed once per instance for its input and output size. When downsampling,
+/// the cutoff drops to the output Nyquist and the filter widens accordingly.
+/// process() is const and can be called from several threads at once.
+class PeriodicResampler
+{
+public:
+	PeriodicResampler(int inputSize, int outputSize, ResamplerQuality quality = ResamplerQuality::normal)
+		: inputSize(std::max(inputSize, 1)), outputSize(std::max(outputSize, 1)) {
+		const auto [zeroCrossings, phases, beta] = getPreset(quality);
+		numPhases = phases;
+		const double cutoff = std::min(1., static_cast<double>(this->outputSize) / this->inputSize);
+		const int halfTaps = static_cast<int>(std::ceil(zeroCrossings / cutoff));
+		numTaps = 2 * halfTaps;
+		rowSize = (numTaps + 3) / 4 * 4;
+
+		// row p holds the taps for a fractional position of p / numPhases, one extra row for interpolating the last phase
+		bank.assign(static_cast<size_t>(rowSize) * (numPhases + 1), 0.f);
+		for (int p = 0; p <= numPhases; ++p) {
+			const double frac = static_cast<double>(p) / numPhases;
+			float* row = bank.data() + static_cast<size_t>(p) * rowSize;
+			double sum{};
+			for (int k = 0; k < numTaps; ++k) {
+				const double t = k - (halfTaps - 1) - frac;
+				const double h = cutoff * sinc(cutoff * t) * kaiser(t / halfTaps, beta);
+				row[k] = static_cast<float>(h);
+				sum += h;
+			}
+			for (int k = 0; k < numTaps; ++k) {
+				row[k] = static_cast<float>(row[k] / sum); // unity gain at DC
+			}
+		}
+	}
+
+	int getInputSize() const { return inputSize; }
+	int getOutputSize() const { return outputSize; }
+
+	/// @param in   inputSize samples, one period
+	/// @param out  outputSize samples
+	template<class OutputType>
+	void process(const float* in, OutputType* out, float gain = 1.f) const {
+		// the period, extended on both sides, so the filter never has to wrap
+		const int halfTaps = numTaps / 2;
+		std::vector<float> extended(inputSize + rowSize);
+		for (size_t i = 0; i < extended.size(); ++i) {
+			const auto idx = (static_cast<long long>(i) - (halfTaps - 1)) % inputSize;
+			extended[i] = in[idx < 0 ? idx + inputSize : idx];
+		}
+
+		for (int j = 0; j < outputSize; ++j) {
+			// exact integer position: j * inputSize / outputSize
+			const long long numerator = static_cast<long long>(j) * inputSize;
+			const auto i0 = static_cast<int>(numerator / outputSize);
+			const double phase = static_cast<double>(numerator % outputSize) / outputSize * numPhases;
+			const auto p = static_cast<int>(phase);
+			const auto mu = static_cast<float>(phase - p);
+			const float* x = extended.data() + i0;
+			const float* row = bank.data() + static_cast<size_t>(p) * rowSize;
+			const float y0 = dot(x, row);
+			const float y1 = dot(x, row + rowSize);
+			out[j] = static_cast<OutputType>(gain * (y0 + mu * (y1 - y0)));
+		}
+	}
+
+private:
+	struct Preset
+	{
+		int zeroCrossings;
+		int numPhases;
+		double beta;
+	};
+
+	static Preset getPreset(ResamplerQuality quality) {
+		switch (quality) {
+		case ResamplerQuality::draft: return { 8, 64, 6. };
+		case ResamplerQuality::high: return { 32, 1024, 11. };
+		default: return { 16, 256, 8.5 };
+		}
+	}
+
+	static double sinc(double x) {
+		if (std::abs(x) < 1e-12) { return 1.; }
+		return std::sin(M_PI * x) / (M_PI * x);
+	}
+
+	// Zeroth order modified Bessel function of the first kind, power series
+	static double besselI0(double x) {
+		double sum = 1., term = 1.;
+		for (int k = 1; k < 50; ++k) {
+			term *= (x / (2. * k)) * (x / (2. * k));
+			sum += term;
+			if (term < sum * 1e-16) { break; }
+		}
+		return sum;
+	}
+
+	// Kaiser window for x in [-1, 1]
+	static double kaiser(double x, double beta) {
+		if (std::abs(x) >= 1.) { return 0.; }
+		return besselI0(beta * std::sqrt(1. - x * x)) / besselI0(beta);
+	}
+
+	// rowSize is a multiple of 4, the padding taps are zero
+	float dot(const float* x, const float* row) const {
+#if defined(BFA_RESAMPLER_SSE2)
+		__m128 acc = _mm_setzero_ps();
+		for (int k = 0; k < rowSize; k += 4) {
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(row + k)));
+		}
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, acc);
+		return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+		float acc{};
+		for (int k = 0; k < rowSize; ++k) {
+			acc += x[k] * row[k];
+		}
+		return acc;
+#endif
+	}
+
+	int inputSize{}, outputSize{};
+	int numTaps{}, rowSize{}, numPhases{};
+	std::vector<float> bank;
+};
+
+}